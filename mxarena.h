@@ -0,0 +1,330 @@
+/*
+ * ----------------------------------------------------------------------
+ * |\ /| mxarena.h
+ * | X | Arena Allocator
+ * |/ \|
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef MXARENA_H
+#define MXARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mxutil.h"
+
+
+/**
+ * The alignment of arena allocations.
+ */
+#define MXARENA_ALIGN 16
+
+
+/**
+ * The default size of arena blocks.
+ */
+#define MXARENA_BLOCK_SIZE 65536
+
+
+/**
+ * An arena block header. The block memory follows the header.
+ */
+typedef struct mxarena_block_s {
+    struct mxarena_block_s *next; /**< The next block in the chain */
+    size_t                  size; /**< The usable size of the block */
+} mxarena_block_t;
+
+
+/**
+ * An arena (bump) allocator.
+ *
+ * Memory is allocated from a chain of large blocks by advancing a pointer.
+ * Individual allocations are not freed. Instead, all allocations are
+ * released together using mxarena_reset(), which keeps the blocks for
+ * reuse, or mxarena_free(), which returns them to the system. Blocks are
+ * allocated using the global allocator (see mxutil_allocator_set()).
+ *
+ * This suits request scoped workloads, where many short lived strings and
+ * buffers are created while processing a request and discarded together
+ * at the end. An arena is not thread safe; typically each thread uses its
+ * own arenas, so there is no contention between threads.
+ */
+typedef struct {
+    mxarena_block_t *first;      /**< The first block in the chain */
+    mxarena_block_t *current;    /**< The block being allocated from */
+    unsigned char   *ptr;        /**< The next free memory in the block */
+    unsigned char   *end;        /**< The end of the current block */
+    size_t           block_size; /**< The size of new blocks */
+} mxarena_t;
+
+
+/**
+ * Round a size up to the arena alignment.
+ */
+static inline size_t
+mxarena_align(size_t size)
+{
+    assert(size <= SIZE_MAX - (MXARENA_ALIGN - 1));
+
+    return (size + MXARENA_ALIGN - 1) & ~(size_t)(MXARENA_ALIGN - 1);
+}
+
+
+/**
+ * Get the memory associated with an arena block.
+ */
+static inline unsigned char *
+mxarena_block_data(mxarena_block_t *block)
+{
+    return (unsigned char *)block + mxarena_align(sizeof(mxarena_block_t));
+}
+
+
+/**
+ * Initialise an arena.
+ *
+ * No memory is allocated until the first allocation is made.
+ *
+ * @param[in] arena
+ *   The arena to initialise.
+ *
+ * @param[in] block_size
+ *   The size of the blocks to allocate, or 0 for MXARENA_BLOCK_SIZE.
+ *   Allocations larger than the block size are given their own block.
+ */
+static inline void
+mxarena_create(mxarena_t *arena, size_t block_size)
+{
+    memset(arena, 0, sizeof(*arena));
+    arena->block_size = (block_size > 0) ? block_size : MXARENA_BLOCK_SIZE;
+}
+
+
+/**
+ * Move to the next block with at least the requested space, allocating a
+ * new block if required.
+ */
+static inline void
+mxarena_grow(mxarena_t *arena, size_t size)
+{
+    mxarena_block_t *next;
+    mxarena_block_t *block;
+    size_t           block_size;
+
+    next = (arena->current != NULL) ? arena->current->next : arena->first;
+
+    if (next == NULL || next->size < size) {
+        block_size = mxarena_align(max(size, arena->block_size));
+        assert(block_size <= SIZE_MAX - sizeof(mxarena_block_t) -
+               MXARENA_ALIGN);
+
+        block = mxutil_malloc(mxarena_align(sizeof(mxarena_block_t)) +
+                              block_size);
+        block->size = block_size;
+        block->next = next;
+
+        if (arena->current != NULL) {
+            arena->current->next = block;
+        } else {
+            arena->first = block;
+        }
+
+        next = block;
+    }
+
+    arena->current = next;
+    arena->ptr = mxarena_block_data(next);
+    arena->end = &arena->ptr[next->size];
+}
+
+
+/**
+ * Allocate memory from an arena.
+ *
+ * NULL is never returned.
+ *
+ * @param[in] arena
+ *   The arena.
+ *
+ * @param[in] size
+ *   The size of memory to allocate. A size of 0 is allocated as 1, so
+ *   that a distinct non-NULL pointer is returned.
+ *
+ * @return
+ *   Pointer to the allocated memory, aligned to MXARENA_ALIGN.
+ */
+static inline void *
+mxarena_alloc(mxarena_t *arena, size_t size)
+{
+    unsigned char *ptr;
+
+    size = mxarena_align(max(size, 1));
+
+    if ((size_t)(arena->end - arena->ptr) < size) {
+        mxarena_grow(arena, size);
+    }
+
+    ptr = arena->ptr;
+    arena->ptr += size;
+
+    return ptr;
+}
+
+
+/**
+ * Resize memory allocated from an arena.
+ *
+ * The most recent allocation is resized in place when there is space in
+ * the current block. Otherwise new memory is allocated and the contents
+ * copied; the old memory is not reclaimed until the arena is reset.
+ *
+ * @param[in] arena
+ *   The arena.
+ *
+ * @param[in] ptr
+ *   The memory to resize, previously allocated from the arena. NULL may be
+ *   passed.
+ *
+ * @param[in] old_size
+ *   The current size of the memory.
+ *
+ * @param[in] size
+ *   The new size.
+ *
+ * @return
+ *   Pointer to the resized memory.
+ */
+static inline void *
+mxarena_realloc(mxarena_t *arena, void *ptr, size_t old_size, size_t size)
+{
+    unsigned char *mem = ptr;
+    void          *new_ptr;
+
+    if (mem != NULL && &mem[mxarena_align(max(old_size, 1))] == arena->ptr &&
+        mxarena_align(max(size, 1)) <= (size_t)(arena->end - mem)) {
+        arena->ptr = &mem[mxarena_align(max(size, 1))];
+        return mem;
+    }
+
+    new_ptr = mxarena_alloc(arena, size);
+
+    if (mem != NULL) {
+        memcpy(new_ptr, mem, min(old_size, size));
+    }
+
+    return new_ptr;
+}
+
+
+/**
+ * Allocator function: allocate from an arena.
+ */
+static inline void *
+mxarena_allocator_alloc(void *ctx, size_t size)
+{
+    return mxarena_alloc(ctx, size);
+}
+
+
+/**
+ * Allocator function: resize memory allocated from an arena.
+ */
+static inline void *
+mxarena_allocator_resize(void *ctx, void *ptr, size_t old_size, size_t size)
+{
+    return mxarena_realloc(ctx, ptr, old_size, size);
+}
+
+
+/**
+ * Allocator function: release memory allocated from an arena.
+ *
+ * Arena memory is only released by resetting the arena, so this does
+ * nothing.
+ */
+static inline void
+mxarena_allocator_release(void *ctx, void *ptr, size_t size)
+{
+    UNUSED(ctx);
+    UNUSED(ptr);
+    UNUSED(size);
+}
+
+
+/**
+ * Allocator function: get the usable size of arena memory.
+ */
+static inline size_t
+mxarena_allocator_usable_size(void *ctx, void *ptr, size_t size)
+{
+    UNUSED(ctx);
+    UNUSED(ptr);
+
+    return mxarena_align(size);
+}
+
+
+/**
+ * Get an allocator that allocates from an arena.
+ *
+ * The arena is passed as the allocator context. For example, to use an
+ * arena for a buffer:
+ *
+ *     mxbuf_allocator(&buf, mxarena_allocator(), &arena);
+ *
+ * The arena allocator requires the size of allocations to be passed when
+ * they are resized, so it should not be installed as the global
+ * allocator.
+ */
+static inline const mxutil_allocator_t *
+mxarena_allocator(void)
+{
+    static const mxutil_allocator_t allocator = {
+        mxarena_allocator_alloc,
+        mxarena_allocator_resize,
+        mxarena_allocator_release,
+        mxarena_allocator_usable_size,
+    };
+
+    return &allocator;
+}
+
+
+/**
+ * Release all allocations made from an arena.
+ *
+ * The blocks are kept and reused for subsequent allocations. This takes
+ * constant time, regardless of the number of allocations.
+ */
+static inline void
+mxarena_reset(mxarena_t *arena)
+{
+    arena->current = NULL;
+    arena->ptr = NULL;
+    arena->end = NULL;
+}
+
+
+/**
+ * Free all the memory associated with an arena.
+ *
+ * The arena may continue to be used, and allocates new blocks as needed.
+ */
+static inline void
+mxarena_free(mxarena_t *arena)
+{
+    mxarena_block_t *block;
+
+    while (arena->first != NULL) {
+        block = arena->first;
+        arena->first = block->next;
+        mxutil_free(block);
+    }
+
+    mxarena_reset(arena);
+}
+
+
+#endif
@@ -0,0 +1,499 @@
+/*
+ * ----------------------------------------------------------------------
+ * |\ /| mxchain.h
+ * | X | Segmented Output Buffer
+ * |/ \|
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef MXCHAIN_H
+#define MXCHAIN_H
+
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "mxstr.h"
+
+
+/**
+ * The default chain segment size.
+ */
+#define MXCHAIN_SEGMENT_SIZE 16384
+
+
+/**
+ * The system limit on the number of segments passed to a single writev()
+ * call. mxchain_writev() uses smaller batches where this is larger.
+ */
+#ifdef IOV_MAX
+#define MXCHAIN_IOV_MAX IOV_MAX
+#else
+#define MXCHAIN_IOV_MAX 1024
+#endif
+
+
+/**
+ * A chain segment header. The segment data follows the header.
+ */
+typedef struct mxchain_seg_s {
+    struct mxchain_seg_s *next; /**< The next segment */
+    size_t                len;  /**< The amount of data in the segment */
+    size_t                size; /**< The capacity of the segment */
+} mxchain_seg_t;
+
+
+/**
+ * A segmented output buffer.
+ *
+ * A chain is written to in the same way as a mxbuf_t buffer, but stores
+ * its contents in a list of segments rather than a single block of memory.
+ * When more space is needed a new segment is added, so data that has been
+ * written is never copied. The contents may be output using writev()
+ * without being assembled into a single block:
+ *
+ *     mxchain_t chain;
+ *
+ *     mxchain_create(&chain, 0);
+ *     mxchain_write(&chain, headers);
+ *     mxchain_write(&chain, body);
+ *     ok = mxchain_writev(&chain, fd);
+ *     mxchain_free(&chain);
+ *
+ * Functions that need contiguous space (e.g. mxchain_reserve()) start a new
+ * segment if the current segment does not have enough space left.
+ */
+typedef struct {
+    mxchain_seg_t *head;      /**< The first segment */
+    mxchain_seg_t *tail;      /**< The segment being written to */
+    mxstr_t        available; /**< The remaining space in the tail segment */
+    size_t         seg_size;  /**< The size of new segments */
+} mxchain_t;
+
+
+/**
+ * Get the data of a chain segment.
+ */
+static inline unsigned char *
+mxchain_seg_data(mxchain_seg_t *seg)
+{
+    return (unsigned char *)&seg[1];
+}
+
+
+/**
+ * Initialise a chain.
+ *
+ * No memory is allocated until data is written.
+ *
+ * @param[in] chain
+ *   The chain to initialise.
+ *
+ * @param[in] seg_size
+ *   The size of the segments to allocate, or 0 for MXCHAIN_SEGMENT_SIZE.
+ */
+static inline void
+mxchain_create(mxchain_t *chain, size_t seg_size)
+{
+    memset(chain, 0, sizeof(*chain));
+    chain->seg_size = (seg_size > 0) ? seg_size : MXCHAIN_SEGMENT_SIZE;
+}
+
+
+/**
+ * Free the memory associated with a chain.
+ *
+ * The chain is left empty, and may continue to be used.
+ */
+static inline void
+mxchain_free(mxchain_t *chain)
+{
+    mxchain_seg_t *seg;
+
+    while (chain->head != NULL) {
+        seg = chain->head;
+        chain->head = seg->next;
+        mxutil_free(seg);
+    }
+
+    chain->tail = NULL;
+    chain->available = mxstr(NULL, 0);
+}
+
+
+/**
+ * Update the length of the tail segment from the space remaining.
+ */
+static inline void
+mxchain_sync(mxchain_t *chain)
+{
+    if (chain->tail != NULL) {
+        chain->tail->len = chain->tail->size - chain->available.len;
+    }
+}
+
+
+/**
+ * Append a new segment to a chain.
+ *
+ * @param[in] chain
+ *   The chain.
+ *
+ * @param[in] size
+ *   The minimum size of the segment.
+ */
+static inline void
+mxchain_add_seg(mxchain_t *chain, size_t size)
+{
+    mxchain_seg_t *seg;
+
+    size = max(size, chain->seg_size);
+    assert(size <= SIZE_MAX - sizeof(mxchain_seg_t));
+
+    seg = mxutil_malloc(sizeof(mxchain_seg_t) + size);
+    seg->next = NULL;
+    seg->len = 0;
+    seg->size = size;
+
+    mxchain_sync(chain);
+
+    if (chain->tail != NULL) {
+        chain->tail->next = seg;
+    } else {
+        chain->head = seg;
+    }
+
+    chain->tail = seg;
+    chain->available = mxstr((char *)mxchain_seg_data(seg), size);
+}
+
+
+/**
+ * Ensure there is contiguous space available at the end of a chain.
+ *
+ * @param[in] chain
+ *   The chain.
+ *
+ * @param[in] size
+ *   The space required.
+ */
+static inline void
+mxchain_require(mxchain_t *chain, size_t size)
+{
+    if (chain->available.len < size) {
+        mxchain_add_seg(chain, size);
+    }
+}
+
+
+/**
+ * Reserve contiguous space in a chain to write to directly.
+ *
+ * See mxbuf_reserve().
+ *
+ * @param[in] chain
+ *   The chain.
+ *
+ * @param[in] size
+ *   The minimum space to reserve.
+ *
+ * @return
+ *   The writable space at the end of the chain, at least size characters.
+ */
+static inline mxstr_t
+mxchain_reserve(mxchain_t *chain, size_t size)
+{
+    mxchain_require(chain, size);
+
+    return chain->available;
+}
+
+
+/**
+ * Commit data written to space returned by mxchain_reserve().
+ *
+ * @param[in] chain
+ *   The chain.
+ *
+ * @param[in] len
+ *   The number of characters written to the start of the reserved space.
+ */
+static inline void
+mxchain_commit(mxchain_t *chain, size_t len)
+{
+    assert(len <= chain->available.len);
+
+    (void)mxstr_consume(&chain->available, len);
+}
+
+
+/**
+ * Write a string to a chain.
+ *
+ * The string may be split across segments.
+ *
+ * @param[in] chain
+ *   The chain to write to.
+ *
+ * @param[in] str
+ *   The string to write.
+ *
+ * @return
+ *   The number of characters written (i.e. str.len)
+ */
+static inline size_t
+mxchain_write(mxchain_t *chain, mxstr_t str)
+{
+    size_t len = str.len;
+
+    if (!mxstr_empty(chain->available)) {
+        (void)mxstr_consume(&str, mxstr_write(&chain->available, str));
+    }
+
+    if (!mxstr_empty(str)) {
+        mxchain_add_seg(chain, str.len);
+        (void)mxstr_write(&chain->available, str);
+    }
+
+    return len;
+}
+
+
+/**
+ * Write a character to a chain.
+ *
+ * @return
+ *   Indicates whether the character was written successfully. (i.e. always
+ *   returns true).
+ */
+static inline bool
+mxchain_putc(mxchain_t *chain, unsigned char c)
+{
+    mxchain_require(chain, 1);
+
+    return mxstr_putc(&chain->available, c);
+}
+
+
+/**
+ * Write repeated characters to a chain.
+ *
+ * @return
+ *   The number of characters that were written (i.e. n).
+ */
+static inline size_t
+mxchain_write_chars(mxchain_t *chain, unsigned char c, size_t n)
+{
+    size_t len = n;
+
+    if (!mxstr_empty(chain->available)) {
+        n -= mxstr_write_chars(&chain->available, c, n);
+    }
+
+    if (n > 0) {
+        mxchain_add_seg(chain, n);
+        (void)mxstr_write_chars(&chain->available, c, n);
+    }
+
+    return len;
+}
+
+
+/**
+ * Write a UTF-8 encoded unicode codepoint to a chain.
+ *
+ * @return
+ *   Indicates whether the codepoint was successfully written. false is
+ *   returned if the codepoint is out of range.
+ */
+static inline bool
+mxchain_put_utf8(mxchain_t *chain, uint32_t c)
+{
+    size_t len;
+
+    len = mxstr_utf8_len(c);
+    if (len == 0) {
+        return false;
+    }
+
+    mxchain_require(chain, len);
+
+    return mxstr_put_utf8(&chain->available, c);
+}
+
+
+/**
+ * Get the total length of the data in a chain.
+ */
+static inline size_t
+mxchain_len(mxchain_t *chain)
+{
+    mxchain_seg_t *seg;
+    size_t         len = 0;
+
+    mxchain_sync(chain);
+
+    for (seg = chain->head; seg != NULL; seg = seg->next) {
+        len += seg->len;
+    }
+
+    return len;
+}
+
+
+/**
+ * Get the contents of a chain as an array of I/O vectors.
+ *
+ * Empty segments are skipped.
+ *
+ * @param[in] chain
+ *   The chain.
+ *
+ * @param[out] iov
+ *   The array to fill in.
+ *
+ * @param[in] count
+ *   The size of the iov array.
+ *
+ * @return
+ *   The number of entries needed to describe the whole chain. If this is
+ *   larger than count, only the first count entries have been filled in.
+ */
+static inline size_t
+mxchain_iovec(mxchain_t *chain, struct iovec *iov, size_t count)
+{
+    mxchain_seg_t *seg;
+    size_t         idx = 0;
+
+    mxchain_sync(chain);
+
+    for (seg = chain->head; seg != NULL; seg = seg->next) {
+        if (seg->len > 0) {
+            if (idx < count) {
+                iov[idx].iov_base = mxchain_seg_data(seg);
+                iov[idx].iov_len = seg->len;
+            }
+            idx++;
+        }
+    }
+
+    return idx;
+}
+
+
+/**
+ * Write the contents of a chain to a file descriptor.
+ *
+ * The data is written using writev() in batches of up to 64 segments
+ * (fewer if IOV_MAX is smaller), handling partial writes. The chain
+ * itself is not modified.
+ *
+ * @param[in] chain
+ *   The chain.
+ *
+ * @param[in] fd
+ *   The file descriptor to write to.
+ *
+ * @return
+ *   Indicates whether all the data was written. On failure, errno is set.
+ *   Some of the data may already have been written, and the amount is
+ *   not reported, so the output cannot be resumed after an error such as
+ *   EAGAIN on a non-blocking file descriptor.
+ */
+static inline bool
+mxchain_writev(mxchain_t *chain, int fd)
+{
+    struct iovec   iov[64];
+    mxchain_seg_t *seg;
+    size_t         first;
+    size_t         count;
+    ssize_t        len;
+
+    mxchain_sync(chain);
+    seg = chain->head;
+
+    while (seg != NULL) {
+        /* Gather the next batch of segments. */
+        for (count = 0;
+             seg != NULL && count < min(mxarray_size(iov), MXCHAIN_IOV_MAX);
+             seg = seg->next) {
+            if (seg->len > 0) {
+                iov[count].iov_base = mxchain_seg_data(seg);
+                iov[count].iov_len = seg->len;
+                count++;
+            }
+        }
+
+        first = 0;
+        while (first < count) {
+            len = writev(fd, &iov[first], (int)(count - first));
+            if (len < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+
+            /* Skip fully written vectors, and adjust a partial one. */
+            while (first < count && (size_t)len >= iov[first].iov_len) {
+                len -= iov[first].iov_len;
+                first++;
+            }
+
+            if (first < count) {
+                iov[first].iov_base = (char *)iov[first].iov_base + len;
+                iov[first].iov_len -= len;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * Flatten a chain into a single segment.
+ *
+ * When the chain has more than one segment, its contents are copied into
+ * a single new segment.
+ *
+ * @param[in] chain
+ *   The chain.
+ *
+ * @return
+ *   The contents of the chain. This remains valid until the chain is next
+ *   modified.
+ */
+static inline mxstr_t
+mxchain_flatten(mxchain_t *chain)
+{
+    mxchain_t      flat;
+    mxchain_seg_t *seg;
+    size_t         len;
+
+    len = mxchain_len(chain);
+
+    if (chain->head != chain->tail) {
+        mxchain_create(&flat, chain->seg_size);
+        mxchain_add_seg(&flat, len);
+
+        for (seg = chain->head; seg != NULL; seg = seg->next) {
+            (void)mxstr_write(&flat.available,
+                              mxstr((char *)mxchain_seg_data(seg), seg->len));
+        }
+
+        mxchain_free(chain);
+        *chain = flat;
+        mxchain_sync(chain);
+    }
+
+    if (chain->head == NULL) {
+        return mxstr(NULL, 0);
+    }
+
+    return mxstr((char *)mxchain_seg_data(chain->head), len);
+}
+
+
+#endif
@@ -0,0 +1,726 @@
+/*
+ * ----------------------------------------------------------------------
+ * |\ /| mxfmt.h
+ * | X | Formatted Output
+ * |/ \|
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef MXFMT_H
+#define MXFMT_H
+
+#include "mxnum.h"
+
+
+/*
+ * ----------------------------------------------------------------------
+ * Format strings
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Format strings use printf() style conversions:
+ *
+ *     %[flags][width]conversion
+ *
+ * The flags are '-' to left justify the value within the width, and '0'
+ * to pad numbers with leading zeros (infinity and NaN are padded with
+ * spaces). The conversions are:
+ *
+ *     d, i, u   Decimal integer
+ *     x         Hexadecimal integer (lower case)
+ *     c         Character, from an integer
+ *     g         Shortest round-trip double or float (see mxbuf_put_double())
+ *     s         mxstr_t or NUL terminated string
+ *     p         Pointer
+ *     %         A '%' character
+ *
+ * The type of each argument is taken from the argument itself rather than
+ * from the conversion, so there are no length modifiers, and an mxstr_t
+ * is written directly with "%s". Because of this, the width of a signed
+ * argument is not known, so a negative signed argument is rejected by 'u'
+ * and 'x' rather than converted as by printf(). A format string may be
+ * compiled once into an mxfmt_t, which avoids parsing it each time it is
+ * used.
+ */
+
+#define MXFMT_MAX_SPECS         32
+
+
+/**
+ * Format specification flags.
+ */
+enum {
+    MXFMT_LEFT = 1 << 0,        /**< Left justify */
+    MXFMT_ZERO = 1 << 1         /**< Pad with leading zeros */
+};
+
+
+/**
+ * A format argument type.
+ */
+typedef enum {
+    MXFMT_ARG_I64,              /**< Signed integer */
+    MXFMT_ARG_U64,              /**< Unsigned integer */
+    MXFMT_ARG_DOUBLE,           /**< Double */
+    MXFMT_ARG_FLOAT,            /**< Float */
+    MXFMT_ARG_STR,              /**< String reference */
+    MXFMT_ARG_CSTR,             /**< NUL terminated string */
+    MXFMT_ARG_PTR               /**< Pointer */
+} mxfmt_type_t;
+
+
+/**
+ * A format argument.
+ */
+typedef struct {
+    mxfmt_type_t type;          /**< The argument type */
+    union {
+        int64_t     i64;
+        uint64_t    u64;
+        double      d;
+        float       f;
+        mxstr_t     str;
+        const char *cstr;
+        const void *ptr;
+    } value;                    /**< The argument value */
+} mxfmt_arg_t;
+
+
+/**
+ * A conversion specification and the literal text preceding it.
+ */
+typedef struct {
+    mxstr_t       literal;      /**< Text to write before the conversion */
+    size_t        width;        /**< Minimum width */
+    unsigned char flags;        /**< MXFMT_LEFT, MXFMT_ZERO */
+    unsigned char conv;         /**< Conversion, or 0 for literal only */
+} mxfmt_spec_t;
+
+
+/**
+ * A compiled format string.
+ *
+ * The literal text of the specifications references the format string,
+ * which must remain valid while the compiled format is used.
+ */
+typedef struct {
+    mxfmt_spec_t specs[MXFMT_MAX_SPECS]; /**< The specifications */
+    size_t       count;         /**< Number of specifications */
+    size_t       args;          /**< Number of arguments consumed */
+} mxfmt_t;
+
+
+/**
+ * Create a signed integer format argument.
+ */
+static inline mxfmt_arg_t
+mxfmt_i64(int64_t value)
+{
+    mxfmt_arg_t arg;
+
+    arg.type = MXFMT_ARG_I64;
+    arg.value.i64 = value;
+
+    return arg;
+}
+
+
+/**
+ * Create an unsigned integer format argument.
+ */
+static inline mxfmt_arg_t
+mxfmt_u64(uint64_t value)
+{
+    mxfmt_arg_t arg;
+
+    arg.type = MXFMT_ARG_U64;
+    arg.value.u64 = value;
+
+    return arg;
+}
+
+
+/**
+ * Create a double format argument.
+ */
+static inline mxfmt_arg_t
+mxfmt_double(double value)
+{
+    mxfmt_arg_t arg;
+
+    arg.type = MXFMT_ARG_DOUBLE;
+    arg.value.d = value;
+
+    return arg;
+}
+
+
+/**
+ * Create a float format argument.
+ */
+static inline mxfmt_arg_t
+mxfmt_float(float value)
+{
+    mxfmt_arg_t arg;
+
+    arg.type = MXFMT_ARG_FLOAT;
+    arg.value.f = value;
+
+    return arg;
+}
+
+
+/**
+ * Create a string reference format argument.
+ */
+static inline mxfmt_arg_t
+mxfmt_str(mxstr_t value)
+{
+    mxfmt_arg_t arg;
+
+    arg.type = MXFMT_ARG_STR;
+    arg.value.str = value;
+
+    return arg;
+}
+
+
+/**
+ * Create a NUL terminated string format argument.
+ */
+static inline mxfmt_arg_t
+mxfmt_cstr(const char *value)
+{
+    mxfmt_arg_t arg;
+
+    arg.type = MXFMT_ARG_CSTR;
+    arg.value.cstr = value;
+
+    return arg;
+}
+
+
+/**
+ * Create a pointer format argument.
+ */
+static inline mxfmt_arg_t
+mxfmt_ptr(const void *value)
+{
+    mxfmt_arg_t arg;
+
+    arg.type = MXFMT_ARG_PTR;
+    arg.value.ptr = value;
+
+    return arg;
+}
+
+
+/**
+ * Consume the literal text and the next conversion specification from a
+ * format string.
+ *
+ * A "%%" is returned as a specification with no conversion, whose literal
+ * text ends with the '%'.
+ *
+ * @param[in,out] str
+ *   The format string.
+ *
+ * @param[out] spec
+ *   The specification. If the format string has no more conversions, the
+ *   remaining text is returned with no conversion.
+ *
+ * @return
+ *   Indicates whether the specification is valid.
+ */
+static inline bool
+mxfmt_consume_spec(mxstr_t *str, mxfmt_spec_t *spec)
+{
+    size_t        idx;
+    unsigned char c = 0;
+
+    spec->width = 0;
+    spec->flags = 0;
+    spec->conv = 0;
+
+    if (!mxstr_find_char(*str, '%', &idx)) {
+        spec->literal = *str;
+        (void)mxstr_consume(str, str->len);
+        return true;
+    }
+
+    spec->literal = mxstr((char *)str->ptr, idx);
+    (void)mxstr_consume(str, idx + 1);
+
+    if (mxstr_consume_str(str, mxstr_literal("%"))) {
+        spec->literal.len++;
+        return true;
+    }
+
+    for (;;) {
+        if (mxstr_consume_str(str, mxstr_literal("-"))) {
+            spec->flags |= MXFMT_LEFT;
+        } else if (mxstr_consume_str(str, mxstr_literal("0"))) {
+            spec->flags |= MXFMT_ZERO;
+        } else {
+            break;
+        }
+    }
+
+    while (mxstr_getchar(*str, &c) && c >= '0' && c <= '9') {
+        if (spec->width > 0xffff) {
+            return false;
+        }
+        spec->width = spec->width * 10 + (c - '0');
+        (void)mxstr_consume(str, 1);
+    }
+
+    if (!mxstr_getchar(*str, &c) || c == '\0' ||
+        strchr("diuxcgsp", c) == NULL) {
+        return false;
+    }
+
+    (void)mxstr_consume(str, 1);
+    spec->conv = (c == 'i') ? 'd' : c;
+
+    return true;
+}
+
+
+/**
+ * Compile a format string.
+ *
+ * For example:
+ *
+ *     static mxfmt_t fmt;
+ *
+ *     ok = mxfmt_compile(&fmt, mxstr_literal("%s=%d\n"));
+ *     ...
+ *     ok = mxbuf_printf(&buf, &fmt, name, value);
+ *
+ * @param[out] fmt
+ *   The compiled format.
+ *
+ * @param[in] str
+ *   The format string. This is referenced by the compiled format.
+ *
+ * @return
+ *   Indicates whether the format string was compiled. false is returned if
+ *   it is invalid, or has more than MXFMT_MAX_SPECS specifications.
+ */
+static inline bool
+mxfmt_compile(mxfmt_t *fmt, mxstr_t str)
+{
+    fmt->count = 0;
+    fmt->args = 0;
+
+    while (!mxstr_empty(str)) {
+        if (fmt->count == MXFMT_MAX_SPECS ||
+            !mxfmt_consume_spec(&str, &fmt->specs[fmt->count])) {
+            return false;
+        }
+
+        fmt->args += (fmt->specs[fmt->count].conv != 0);
+        fmt->count++;
+    }
+
+    return true;
+}
+
+
+/*
+ * ----------------------------------------------------------------------
+ * Formatted output
+ * ----------------------------------------------------------------------
+ */
+
+/**
+ * Write a specification and its argument to a buffer.
+ *
+ * The space required for the literal text and the converted argument is
+ * calculated first, so that the buffer is only checked once.
+ *
+ * @param[in] buffer
+ *   The buffer to write to.
+ *
+ * @param[in] spec
+ *   The specification.
+ *
+ * @param[in] arg
+ *   The argument. Not used if the specification has no conversion.
+ *
+ * @return
+ *   Indicates whether the argument has a type that the conversion accepts
+ *   (and for 'u' and 'x', is not negative). If not nothing is written.
+ */
+static inline bool
+mxbuf_write_spec(mxbuf_t *buffer, const mxfmt_spec_t *spec,
+                 const mxfmt_arg_t *arg)
+{
+    unsigned char  tmp[MXNUM_DOUBLE_LEN];
+    unsigned char *ptr;
+    mxstr_t        str = mxstr(NULL, 0);
+    uint64_t       magnitude = 0;
+    size_t         n;
+    size_t         pad;
+    bool           negative = false;
+    bool           integer;
+
+    if (spec->conv == 0) {
+        (void)mxbuf_write(buffer, spec->literal);
+        return true;
+    }
+
+    integer = (arg->type == MXFMT_ARG_I64 || arg->type == MXFMT_ARG_U64);
+    if (integer) {
+        magnitude = arg->value.u64;
+        if (arg->type == MXFMT_ARG_I64 && arg->value.i64 < 0) {
+            if (spec->conv == 'u' || spec->conv == 'x') {
+                /* The width of the original type is not known. */
+                return false;
+            }
+            if (spec->conv == 'd') {
+                /* Negate as unsigned, so INT64_MIN does not overflow. */
+                negative = true;
+                magnitude = 0 - magnitude;
+            }
+        }
+    }
+
+    /* Find the length of the converted argument. */
+    switch (spec->conv) {
+    case 'd':
+    case 'u':
+        if (!integer) {
+            return false;
+        }
+        n = negative + mxnum_u64_len(magnitude);
+        break;
+
+    case 'x':
+        if (!integer) {
+            return false;
+        }
+        n = mxnum_hex_len(magnitude);
+        break;
+
+    case 'p':
+        if (arg->type != MXFMT_ARG_PTR) {
+            return false;
+        }
+        magnitude = (uintptr_t)arg->value.ptr;
+        n = 2 + mxnum_hex_len(magnitude);
+        break;
+
+    case 'c':
+        if (!integer) {
+            return false;
+        }
+        n = 1;
+        break;
+
+    case 'g':
+        if (arg->type == MXFMT_ARG_DOUBLE) {
+            str = mxstr((char *)tmp, mxnum_format_double(tmp, arg->value.d));
+        } else if (arg->type == MXFMT_ARG_FLOAT) {
+            str = mxstr((char *)tmp, mxnum_format_float(tmp, arg->value.f));
+        } else {
+            return false;
+        }
+        n = str.len;
+        break;
+
+    default:
+        if (arg->type == MXFMT_ARG_STR) {
+            str = arg->value.str;
+        } else if (arg->type == MXFMT_ARG_CSTR) {
+            str = mxstr((char *)arg->value.cstr, strlen(arg->value.cstr));
+        } else {
+            return false;
+        }
+        n = str.len;
+        break;
+    }
+
+    pad = (spec->width > n) ? spec->width - n : 0;
+
+    mxbuf_require(buffer, spec->literal.len + n + pad);
+    ptr = buffer->available.ptr;
+
+    memcpy(ptr, spec->literal.ptr, spec->literal.len);
+    ptr += spec->literal.len;
+
+    if ((spec->flags & MXFMT_LEFT) == 0) {
+        if ((spec->flags & MXFMT_ZERO) != 0 &&
+            (spec->conv == 'd' || spec->conv == 'u' || spec->conv == 'x')) {
+            /* The zeros are written as extra digits. */
+            n += pad;
+        } else if ((spec->flags & MXFMT_ZERO) != 0 && spec->conv == 'g' &&
+                   str.ptr[str.ptr[0] == '-'] >= '0' &&
+                   str.ptr[str.ptr[0] == '-'] <= '9') {
+            /* The zeros follow the sign. Non-finite values are padded
+             * with spaces, as by printf(). */
+            if (str.ptr[0] == '-') {
+                *ptr++ = '-';
+                mxstr_consume(&str, 1);
+                n--;
+            }
+            memset(ptr, '0', pad);
+            ptr += pad;
+        } else {
+            memset(ptr, ' ', pad);
+            ptr += pad;
+        }
+        pad = 0;
+    }
+
+    switch (spec->conv) {
+    case 'd':
+    case 'u':
+        if (negative) {
+            *ptr++ = '-';
+            n--;
+        }
+        mxnum_write_u64(ptr, magnitude, n);
+        break;
+
+    case 'x':
+        mxnum_write_hex(ptr, magnitude, n);
+        break;
+
+    case 'p':
+        ptr[0] = '0';
+        ptr[1] = 'x';
+        mxnum_write_hex(&ptr[2], magnitude, n - 2);
+        break;
+
+    case 'c':
+        ptr[0] = (unsigned char)magnitude;
+        break;
+
+    default:
+        memcpy(ptr, str.ptr, str.len);
+        break;
+    }
+
+    ptr += n;
+    memset(ptr, ' ', pad);
+    ptr += pad;
+
+    mxbuf_commit(buffer, ptr - buffer->available.ptr);
+
+    return true;
+}
+
+
+/**
+ * Write formatted output to a buffer using a compiled format.
+ *
+ * @param[in] buffer
+ *   The buffer to write to.
+ *
+ * @param[in] fmt
+ *   The compiled format.
+ *
+ * @param[in] args
+ *   The arguments.
+ *
+ * @param[in] count
+ *   The number of arguments.
+ *
+ * @return
+ *   Indicates whether the output was written. false is returned if the
+ *   number of arguments does not match the format, or an argument has the
+ *   wrong type for its conversion, in which case the buffer is unchanged.
+ */
+static inline bool
+mxbuf_format(mxbuf_t *buffer, const mxfmt_t *fmt, const mxfmt_arg_t *args,
+             size_t count)
+{
+    size_t start;
+    size_t idx;
+
+    if (count != fmt->args) {
+        return false;
+    }
+
+    start = mxstr_substr_offset(buffer->buf, buffer->available);
+
+    for (idx = 0; idx < fmt->count; idx++) {
+        if (!mxbuf_write_spec(buffer, &fmt->specs[idx], args)) {
+            buffer->available = buffer->buf;
+            (void)mxstr_consume(&buffer->available, start);
+            return false;
+        }
+
+        args += (fmt->specs[idx].conv != 0);
+    }
+
+    return true;
+}
+
+
+/**
+ * Write formatted output to a buffer using a format string.
+ *
+ * The format string is parsed as it is written.
+ *
+ * @param[in] buffer
+ *   The buffer to write to.
+ *
+ * @param[in] str
+ *   The format string.
+ *
+ * @param[in] args
+ *   The arguments.
+ *
+ * @param[in] count
+ *   The number of arguments.
+ *
+ * @return
+ *   Indicates whether the output was written. false is returned if the
+ *   format string is invalid, the number of arguments does not match it,
+ *   or an argument has the wrong type for its conversion, in which case
+ *   the buffer is unchanged.
+ */
+static inline bool
+mxbuf_format_str(mxbuf_t *buffer, mxstr_t str, const mxfmt_arg_t *args,
+                 size_t count)
+{
+    mxfmt_spec_t spec;
+    size_t       start;
+    bool         ok = true;
+
+    start = mxstr_substr_offset(buffer->buf, buffer->available);
+
+    while (ok && !mxstr_empty(str)) {
+        ok = mxfmt_consume_spec(&str, &spec);
+
+        if (ok && spec.conv != 0) {
+            ok = (count > 0);
+            count--;
+        }
+
+        ok = ok && mxbuf_write_spec(buffer, &spec, args);
+        args += (spec.conv != 0);
+    }
+
+    if (!ok || count != 0) {
+        buffer->available = buffer->buf;
+        (void)mxstr_consume(&buffer->available, start);
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * Write formatted output to a buffer using a NUL terminated format string.
+ *
+ * See mxbuf_format_str().
+ */
+static inline bool
+mxbuf_format_cstr(mxbuf_t *buffer, const char *str, const mxfmt_arg_t *args,
+                  size_t count)
+{
+    return mxbuf_format_str(buffer, mxstr((char *)str, strlen(str)), args,
+                            count);
+}
+
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+
+/**
+ * Create a format argument from a value, using its type.
+ */
+#define mxfmt_arg(value_)                                               \
+    _Generic((value_),                                                  \
+             _Bool: mxfmt_u64,                                          \
+             char: mxfmt_i64,                                           \
+             signed char: mxfmt_i64,                                    \
+             short: mxfmt_i64,                                          \
+             int: mxfmt_i64,                                            \
+             long: mxfmt_i64,                                           \
+             long long: mxfmt_i64,                                      \
+             unsigned char: mxfmt_u64,                                  \
+             unsigned short: mxfmt_u64,                                 \
+             unsigned int: mxfmt_u64,                                   \
+             unsigned long: mxfmt_u64,                                  \
+             unsigned long long: mxfmt_u64,                             \
+             float: mxfmt_float,                                        \
+             double: mxfmt_double,                                      \
+             mxstr_t: mxfmt_str,                                        \
+             char *: mxfmt_cstr,                                        \
+             const char *: mxfmt_cstr,                                  \
+             default: mxfmt_ptr)(value_)
+
+#define MXFMT_CAT_(a_, b_)      a_ ## b_
+#define MXFMT_CAT(a_, b_)       MXFMT_CAT_(a_, b_)
+
+#define MXFMT_FIRST_(first_, ...) first_
+#define MXFMT_FIRST(...)        MXFMT_FIRST_(__VA_ARGS__, unused)
+
+/* The number of arguments after the first (0..16). The trailing argument
+ * keeps the variadic part of MXFMT_NARGS_() non-empty, as required by
+ * ISO C, when there are no arguments after the first. */
+#define MXFMT_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12,  \
+                     _13, _14, _15, _16, _17, n_, ...) n_
+#define MXFMT_NARGS(...)                                                \
+    MXFMT_NARGS_(__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, \
+                 4, 3, 2, 1, 0, unused)
+
+/* Convert the arguments after the first, each preceded by a comma. */
+#define MXFMT_ARGS_0(f_)
+#define MXFMT_ARGS_1(f_, a_)      , mxfmt_arg(a_)
+#define MXFMT_ARGS_2(f_, a_, ...) , mxfmt_arg(a_) MXFMT_ARGS_1(f_, __VA_ARGS__)
+#define MXFMT_ARGS_3(f_, a_, ...) , mxfmt_arg(a_) MXFMT_ARGS_2(f_, __VA_ARGS__)
+#define MXFMT_ARGS_4(f_, a_, ...) , mxfmt_arg(a_) MXFMT_ARGS_3(f_, __VA_ARGS__)
+#define MXFMT_ARGS_5(f_, a_, ...) , mxfmt_arg(a_) MXFMT_ARGS_4(f_, __VA_ARGS__)
+#define MXFMT_ARGS_6(f_, a_, ...) , mxfmt_arg(a_) MXFMT_ARGS_5(f_, __VA_ARGS__)
+#define MXFMT_ARGS_7(f_, a_, ...) , mxfmt_arg(a_) MXFMT_ARGS_6(f_, __VA_ARGS__)
+#define MXFMT_ARGS_8(f_, a_, ...) , mxfmt_arg(a_) MXFMT_ARGS_7(f_, __VA_ARGS__)
+#define MXFMT_ARGS_9(f_, a_, ...) , mxfmt_arg(a_) MXFMT_ARGS_8(f_, __VA_ARGS__)
+#define MXFMT_ARGS_10(f_, a_, ...) , mxfmt_arg(a_) MXFMT_ARGS_9(f_, __VA_ARGS__)
+#define MXFMT_ARGS_11(f_, a_, ...) , mxfmt_arg(a_) MXFMT_ARGS_10(f_, __VA_ARGS__)
+#define MXFMT_ARGS_12(f_, a_, ...) , mxfmt_arg(a_) MXFMT_ARGS_11(f_, __VA_ARGS__)
+#define MXFMT_ARGS_13(f_, a_, ...) , mxfmt_arg(a_) MXFMT_ARGS_12(f_, __VA_ARGS__)
+#define MXFMT_ARGS_14(f_, a_, ...) , mxfmt_arg(a_) MXFMT_ARGS_13(f_, __VA_ARGS__)
+#define MXFMT_ARGS_15(f_, a_, ...) , mxfmt_arg(a_) MXFMT_ARGS_14(f_, __VA_ARGS__)
+#define MXFMT_ARGS_16(f_, a_, ...) , mxfmt_arg(a_) MXFMT_ARGS_15(f_, __VA_ARGS__)
+
+
+/**
+ * Write formatted output to a buffer (C11).
+ *
+ * The format is either a NUL terminated format string, or a format
+ * compiled using mxfmt_compile(). Up to 16 arguments of integer, floating
+ * point, mxstr_t, string and pointer types are accepted. For example:
+ *
+ *     mxstr_t name = ...;
+ *
+ *     ok = mxbuf_printf(&buf, "Totals\n");
+ *     ok = mxbuf_printf(&buf, "%s: %d items, %g%%\n", name, count, pct);
+ *
+ * @param[in] buffer_
+ *   The buffer to write to.
+ *
+ * @return
+ *   Indicates whether the output was written. See mxbuf_format_str().
+ */
+#define mxbuf_printf(buffer_, ...)                                      \
+    _Generic(MXFMT_FIRST(__VA_ARGS__),                                  \
+             mxfmt_t *: mxbuf_format,                                   \
+             const mxfmt_t *: mxbuf_format,                             \
+             default: mxbuf_format_cstr)(                               \
+        (buffer_), MXFMT_FIRST(__VA_ARGS__),                            \
+        &((const mxfmt_arg_t[]){                                        \
+            mxfmt_i64(0)                                                \
+            MXFMT_CAT(MXFMT_ARGS_, MXFMT_NARGS(__VA_ARGS__))(__VA_ARGS__) \
+        })[1],                                                          \
+        MXFMT_NARGS(__VA_ARGS__))
+
+#endif
+
+
+#endif
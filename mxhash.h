@@ -0,0 +1,807 @@
+/*
+ * ----------------------------------------------------------------------
+ * |\ /| mxhash.h
+ * | X | Non-Cryptographic String Hashing
+ * |/ \|
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef MXHASH_H
+#define MXHASH_H
+
+#include "mxstr.h"
+
+
+/*
+ * ----------------------------------------------------------------------
+ * Hashing
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Two algorithms are used depending on the length of the input:
+ *
+ * - Inputs of up to MXHASH_SHORT_MAX bytes are hashed in the style of
+ *   wyhash (Wang Yi): 16 bytes at a time are folded into the state using
+ *   a 64x64->128 bit multiplication whose halves are XORed together.
+ *   Inputs of up to 16 bytes are read with at most four overlapping
+ *   loads and no loop.
+ *
+ * - Longer inputs are hashed in the style of XXH3 (Yann Collet): eight
+ *   64 bit accumulators each take a 32x32->64 bit product of the input
+ *   XORed with a key, 64 bytes (a stripe) at a time. The key moves along
+ *   a secret for each stripe of a block of MXHASH_BLOCK_STRIPES, after
+ *   which the accumulators are scrambled. The final stripe is always
+ *   the last 64 bytes of the input (overlapping the previous stripe if
+ *   necessary), so no padding is needed. The accumulation maps directly
+ *   onto AVX2, which is used where available; the result is identical to
+ *   the scalar code.
+ *
+ * The seed is mixed into the state of the short hash and added to the
+ * secret of the long hash. Hash values are the same on all platforms,
+ * but are not compatible with wyhash or XXH3 and may change between
+ * versions of this library, so should not be stored.
+ */
+
+
+/**
+ * The longest input hashed by the short algorithm. This is also the size
+ * of the buffer in a streaming hash state.
+ */
+#define MXHASH_SHORT_MAX 256
+
+
+/**
+ * The number of bytes of input per stripe of the long algorithm.
+ */
+#define MXHASH_STRIPE 64
+
+
+/**
+ * The number of stripes between scrambles of the accumulators.
+ */
+#define MXHASH_BLOCK_STRIPES 16
+
+
+/**
+ * The number of 64 bit words in the secret.
+ */
+#define MXHASH_SECRET_WORDS (MXHASH_BLOCK_STRIPES + 8)
+
+
+/**
+ * The secret offset of the key for the final stripe.
+ */
+#define MXHASH_LAST_KEY 13
+
+
+/**
+ * Constants of the short algorithm (from wyhash).
+ */
+#define MXHASH_P0 0x2d358dccaa6c78a5ULL
+#define MXHASH_P1 0x8bb84b93962eacc9ULL
+#define MXHASH_P2 0x4b33a62ed433d4a3ULL
+
+
+/**
+ * Constants of the long algorithm (from XXH3).
+ */
+#define MXHASH_PRIME32   0x9e3779b1U
+#define MXHASH_PRIME64_1 0x9e3779b185ebca87ULL
+#define MXHASH_PRIME64_2 0xc2b2ae3d27d4eb4fULL
+
+
+/**
+ * The secret of the long algorithm for a seed of 0 (the first outputs of
+ * splitmix64 from a state of 0).
+ */
+static const uint64_t mxhash_secret[MXHASH_SECRET_WORDS] = {
+    0xe220a8397b1dcdafULL, 0x6e789e6aa1b965f4ULL, 0x06c45d188009454fULL,
+    0xf88bb8a8724c81ecULL, 0x1b39896a51a8749bULL, 0x53cb9f0c747ea2eaULL,
+    0x2c829abe1f4532e1ULL, 0xc584133ac916ab3cULL, 0x3ee5789041c98ac3ULL,
+    0xf3b8488c368cb0a6ULL, 0x657eecdd3cb13d09ULL, 0xc2d326e0055bdef6ULL,
+    0x8621a03fe0bbdb7bULL, 0x8e1f7555983aa92fULL, 0xb54e0f1600cc4d19ULL,
+    0x84bb3f97971d80abULL, 0x7d29825c75521255ULL, 0xc3cf17102b7f7f86ULL,
+    0x3466e9a083914f64ULL, 0xd81a8d2b5a4485acULL, 0xdb01602b100b9ed7ULL,
+    0xa9038a921825f10dULL, 0xedf5f1d90dca2f6aULL, 0x54496ad67bd2634cULL
+};
+
+
+/**
+ * A 128 bit hash value.
+ */
+typedef struct {
+    uint64_t low;   /**< The low 64 bits */
+    uint64_t high;  /**< The high 64 bits */
+} mxhash128_t;
+
+
+/**
+ * A streaming hash state.
+ *
+ * Input may be passed in any number of pieces, and the result is the same
+ * as hashing the concatenated input in one go:
+ *
+ *     mxhash_t state;
+ *
+ *     mxhash_init(&state, 0);
+ *     while (...) {
+ *         mxhash_update_buf(&state, &buf);
+ *         mxbuf_reset(&buf);
+ *     }
+ *     hash = mxhash_final64(&state);
+ *
+ * Input is buffered until it is known to be longer than MXHASH_SHORT_MAX,
+ * after which whole stripes are accumulated as they arrive. The last
+ * byte of input is never accumulated before the final call, as it belongs
+ * to the final stripe.
+ */
+typedef struct {
+    uint64_t      acc[8];       /**< The accumulators */
+    uint64_t      secret[MXHASH_SECRET_WORDS]; /**< The seeded secret */
+    uint64_t      seed;         /**< The seed */
+    uint64_t      total;        /**< The total length of the input */
+    size_t        stripe;       /**< The stripe number within the block */
+    size_t        buf_len;      /**< The amount of buffered input */
+    unsigned char buf[MXHASH_SHORT_MAX];  /**< The buffered input */
+    unsigned char last[MXHASH_STRIPE];    /**< The last stripe accumulated */
+} mxhash_t;
+
+
+/**
+ * Multiply two 64 bit integers giving a 128 bit product.
+ *
+ * @return
+ *   The low 64 bits of the product.
+ */
+static inline uint64_t
+mxhash_mum(uint64_t a, uint64_t b, uint64_t *high)
+{
+#ifdef __SIZEOF_INT128__
+    __extension__ unsigned __int128 product = (unsigned __int128)a * b;
+
+    *high = (uint64_t)(product >> 64);
+
+    return (uint64_t)product;
+#else
+    uint64_t lo_lo = (a & 0xffffffff) * (b & 0xffffffff);
+    uint64_t hi_lo = (a >> 32) * (b & 0xffffffff);
+    uint64_t lo_hi = (a & 0xffffffff) * (b >> 32);
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xffffffff) + lo_hi;
+
+    *high = (a >> 32) * (b >> 32) + (hi_lo >> 32) + (cross >> 32);
+
+    return (cross << 32) | (lo_lo & 0xffffffff);
+#endif
+}
+
+
+/**
+ * Multiply two 64 bit integers and XOR the halves of the 128 bit product.
+ */
+static inline uint64_t
+mxhash_mix(uint64_t a, uint64_t b)
+{
+    uint64_t high;
+    uint64_t low = mxhash_mum(a, b, &high);
+
+    return low ^ high;
+}
+
+
+/**
+ * Hash an input of up to MXHASH_SHORT_MAX bytes.
+ *
+ * @param[in] ptr
+ *   The input.
+ *
+ * @param[in] len
+ *   The length of the input.
+ *
+ * @param[in] seed
+ *   The seed.
+ *
+ * @return
+ *   The 64 bit hash value.
+ */
+static inline uint64_t
+mxhash_short(const unsigned char *ptr, size_t len, uint64_t seed)
+{
+    uint64_t a, b, high, see1, see2;
+    size_t   idx, half;
+
+    seed ^= mxhash_mix(seed ^ MXHASH_P0, MXHASH_P1);
+
+    if (len <= 16) {
+        if (len >= 4) {
+            /* Bytes 0-3 and len-4..len-1, plus 4-7 and len-8..len-5 if
+             * there are at least 8. */
+            half = (len >> 3) << 2;
+            a = ((uint64_t)mxutil_load_u32le(ptr) << 32) |
+                mxutil_load_u32le(ptr + half);
+            b = ((uint64_t)mxutil_load_u32le(ptr + len - 4) << 32) |
+                mxutil_load_u32le(ptr + len - 4 - half);
+        } else if (len > 0) {
+            a = ((uint64_t)ptr[0] << 16) | ((uint64_t)ptr[len >> 1] << 8) |
+                ptr[len - 1];
+            b = 0;
+        } else {
+            a = 0;
+            b = 0;
+        }
+    } else {
+        idx = len;
+        if (idx > 48) {
+            see1 = seed;
+            see2 = seed;
+            do {
+                seed = mxhash_mix(mxutil_load_u64le(ptr) ^ MXHASH_P1,
+                                  mxutil_load_u64le(ptr + 8) ^ seed);
+                see1 = mxhash_mix(mxutil_load_u64le(ptr + 16) ^ MXHASH_P2,
+                                  mxutil_load_u64le(ptr + 24) ^ see1);
+                see2 = mxhash_mix(mxutil_load_u64le(ptr + 32) ^ MXHASH_P0,
+                                  mxutil_load_u64le(ptr + 40) ^ see2);
+                ptr += 48;
+                idx -= 48;
+            } while (idx > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (idx > 16) {
+            seed = mxhash_mix(mxutil_load_u64le(ptr) ^ MXHASH_P1,
+                              mxutil_load_u64le(ptr + 8) ^ seed);
+            ptr += 16;
+            idx -= 16;
+        }
+        a = mxutil_load_u64le(ptr + idx - 16);
+        b = mxutil_load_u64le(ptr + idx - 8);
+    }
+
+    a = mxhash_mum(a ^ MXHASH_P1, b ^ seed, &high);
+
+    return mxhash_mix(a ^ MXHASH_P0 ^ len, high ^ MXHASH_P1);
+}
+
+
+/**
+ * Derive the secret of the long algorithm from a seed.
+ */
+static inline void
+mxhash_secret_init(uint64_t *secret, uint64_t seed)
+{
+    size_t idx;
+
+    for (idx = 0; idx < MXHASH_SECRET_WORDS; idx += 2) {
+        secret[idx] = mxhash_secret[idx] + seed;
+        secret[idx + 1] = mxhash_secret[idx + 1] - seed;
+    }
+}
+
+
+/**
+ * Set the initial value of the accumulators of the long algorithm.
+ */
+static inline void
+mxhash_acc_init(uint64_t *acc)
+{
+    acc[0] = 0xc2b2ae3dULL;
+    acc[1] = MXHASH_PRIME64_1;
+    acc[2] = MXHASH_PRIME64_2;
+    acc[3] = 0x165667b19e3779f9ULL;
+    acc[4] = 0x85ebca77c2b2ae63ULL;
+    acc[5] = 0x85ebca77ULL;
+    acc[6] = 0x27d4eb2f165667c5ULL;
+    acc[7] = MXHASH_PRIME32;
+}
+
+
+/**
+ * Accumulate one stripe (scalar kernel).
+ *
+ * @param[in,out] acc
+ *   The accumulators.
+ *
+ * @param[in] ptr
+ *   The stripe.
+ *
+ * @param[in] key
+ *   The 8 words of the secret to use.
+ */
+static inline void
+mxhash_stripe_scalar(uint64_t *acc, const unsigned char *ptr,
+                     const uint64_t *key)
+{
+    uint64_t data, keyed;
+    size_t   idx;
+
+    for (idx = 0; idx < 8; idx++) {
+        data = mxutil_load_u64le(ptr + 8 * idx);
+        keyed = data ^ key[idx];
+        acc[idx ^ 1] += data;
+        acc[idx] += (keyed & 0xffffffff) * (keyed >> 32);
+    }
+}
+
+
+/**
+ * Scramble the accumulators at the end of a block (scalar kernel).
+ */
+static inline void
+mxhash_scramble_scalar(uint64_t *acc, const uint64_t *key)
+{
+    uint64_t value;
+    size_t   idx;
+
+    for (idx = 0; idx < 8; idx++) {
+        value = acc[idx];
+        value ^= value >> 47;
+        value ^= key[idx];
+        acc[idx] = value * MXHASH_PRIME32;
+    }
+}
+
+
+/**
+ * Accumulate a run of stripes (scalar kernel).
+ *
+ * @param[in,out] acc
+ *   The accumulators.
+ *
+ * @param[in] ptr
+ *   The first stripe.
+ *
+ * @param[in] count
+ *   The number of stripes.
+ *
+ * @param[in,out] stripe
+ *   The stripe number of the first stripe within its block, updated to
+ *   that of the stripe following the run.
+ *
+ * @param[in] secret
+ *   The seeded secret.
+ */
+static inline void
+mxhash_stripes_scalar(uint64_t *acc, const unsigned char *ptr, size_t count,
+                      size_t *stripe, const uint64_t *secret)
+{
+    size_t pos = *stripe;
+
+    for (; count > 0; count--, ptr += MXHASH_STRIPE) {
+        mxhash_stripe_scalar(acc, ptr, &secret[pos]);
+        if (++pos == MXHASH_BLOCK_STRIPES) {
+            mxhash_scramble_scalar(acc, &secret[MXHASH_BLOCK_STRIPES]);
+            pos = 0;
+        }
+    }
+
+    *stripe = pos;
+}
+
+
+#ifdef MXUTIL_SIMD_X86
+
+/**
+ * Accumulate a run of stripes (AVX2 kernel).
+ *
+ * Each 64 bit lane is handled as in mxhash_stripe_scalar(): the 32x32->64
+ * bit product is _mm256_mul_epu32() of the keyed input and the keyed
+ * input shifted right by 32, and the input added to the neighbouring
+ * accumulator is the input with its 64 bit halves swapped.
+ *
+ * @return
+ *   See mxhash_stripes_scalar().
+ */
+MXUTIL_TARGET("avx2") static inline void
+mxhash_stripes_avx2(uint64_t *acc, const unsigned char *ptr, size_t count,
+                    size_t *stripe, const uint64_t *secret)
+{
+    const __m256i prime = _mm256_set1_epi32((int)MXHASH_PRIME32);
+    __m256i       acc0 = _mm256_loadu_si256((__m256i *)&acc[0]);
+    __m256i       acc1 = _mm256_loadu_si256((__m256i *)&acc[4]);
+    __m256i       data0, data1, keyed0, keyed1, key0, key1;
+    size_t        pos = *stripe;
+
+    for (; count > 0; count--, ptr += MXHASH_STRIPE) {
+        data0 = _mm256_loadu_si256((__m256i *)ptr);
+        data1 = _mm256_loadu_si256((__m256i *)(ptr + 32));
+        keyed0 = _mm256_xor_si256(
+            data0, _mm256_loadu_si256((__m256i *)&secret[pos]));
+        keyed1 = _mm256_xor_si256(
+            data1, _mm256_loadu_si256((__m256i *)&secret[pos + 4]));
+
+        acc0 = _mm256_add_epi64(acc0, _mm256_add_epi64(
+            _mm256_mul_epu32(keyed0, _mm256_srli_epi64(keyed0, 32)),
+            _mm256_shuffle_epi32(data0, _MM_SHUFFLE(1, 0, 3, 2))));
+        acc1 = _mm256_add_epi64(acc1, _mm256_add_epi64(
+            _mm256_mul_epu32(keyed1, _mm256_srli_epi64(keyed1, 32)),
+            _mm256_shuffle_epi32(data1, _MM_SHUFFLE(1, 0, 3, 2))));
+
+        if (++pos == MXHASH_BLOCK_STRIPES) {
+            key0 = _mm256_loadu_si256(
+                (__m256i *)&secret[MXHASH_BLOCK_STRIPES]);
+            key1 = _mm256_loadu_si256(
+                (__m256i *)&secret[MXHASH_BLOCK_STRIPES + 4]);
+
+            acc0 = _mm256_xor_si256(_mm256_xor_si256(
+                acc0, _mm256_srli_epi64(acc0, 47)), key0);
+            acc1 = _mm256_xor_si256(_mm256_xor_si256(
+                acc1, _mm256_srli_epi64(acc1, 47)), key1);
+
+            /* 64x32 bit multiply from two 32x32 bit multiplies. */
+            acc0 = _mm256_add_epi64(_mm256_mul_epu32(acc0, prime),
+                _mm256_slli_epi64(_mm256_mul_epu32(
+                    _mm256_srli_epi64(acc0, 32), prime), 32));
+            acc1 = _mm256_add_epi64(_mm256_mul_epu32(acc1, prime),
+                _mm256_slli_epi64(_mm256_mul_epu32(
+                    _mm256_srli_epi64(acc1, 32), prime), 32));
+            pos = 0;
+        }
+    }
+
+    _mm256_storeu_si256((__m256i *)&acc[0], acc0);
+    _mm256_storeu_si256((__m256i *)&acc[4], acc1);
+    *stripe = pos;
+}
+
+#endif
+
+
+/**
+ * Accumulate a run of stripes.
+ *
+ * @return
+ *   See mxhash_stripes_scalar().
+ */
+static inline void
+mxhash_stripes(uint64_t *acc, const unsigned char *ptr, size_t count,
+               size_t *stripe, const uint64_t *secret)
+{
+#if defined(MXUTIL_SIMD_X86) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (mxutil_cpu_avx2()) {
+        mxhash_stripes_avx2(acc, ptr, count, stripe, secret);
+        return;
+    }
+#endif
+
+    mxhash_stripes_scalar(acc, ptr, count, stripe, secret);
+}
+
+
+/**
+ * Merge the accumulators of the long algorithm into a 64 bit value.
+ */
+static inline uint64_t
+mxhash_merge(const uint64_t *acc, const uint64_t *key, uint64_t value)
+{
+    size_t idx;
+
+    for (idx = 0; idx < 8; idx += 2) {
+        value += mxhash_mix(acc[idx] ^ key[idx], acc[idx + 1] ^ key[idx + 1]);
+    }
+
+    /* XXH3 avalanche */
+    value ^= value >> 37;
+    value *= 0x165667919e3779f9ULL;
+    value ^= value >> 32;
+
+    return value;
+}
+
+
+/**
+ * Accumulate an input of more than MXHASH_SHORT_MAX bytes.
+ *
+ * @param[out] acc
+ *   The accumulators.
+ *
+ * @param[in] ptr
+ *   The input.
+ *
+ * @param[in] len
+ *   The length of the input.
+ *
+ * @param[in] secret
+ *   The seeded secret.
+ */
+static inline void
+mxhash_long(uint64_t *acc, const unsigned char *ptr, size_t len,
+            const uint64_t *secret)
+{
+    size_t stripe = 0;
+
+    mxhash_acc_init(acc);
+    mxhash_stripes(acc, ptr, (len - 1) / MXHASH_STRIPE, &stripe, secret);
+    mxhash_stripe_scalar(acc, ptr + len - MXHASH_STRIPE,
+                         &secret[MXHASH_LAST_KEY]);
+}
+
+
+/**
+ * Calculate the 64 bit hash of a string using a seed.
+ *
+ * @param[in] str
+ *   The string to hash.
+ *
+ * @param[in] seed
+ *   The seed. Different seeds give unrelated hash functions.
+ *
+ * @return
+ *   The hash value.
+ */
+static inline uint64_t
+mxstr_hash64_seed(mxstr_t str, uint64_t seed)
+{
+    uint64_t acc[8];
+    uint64_t secret[MXHASH_SECRET_WORDS];
+
+    if (str.len <= MXHASH_SHORT_MAX) {
+        return mxhash_short(str.ptr, str.len, seed);
+    }
+
+    mxhash_secret_init(secret, seed);
+    mxhash_long(acc, str.ptr, str.len, secret);
+
+    return mxhash_merge(acc, &secret[1], str.len * MXHASH_PRIME64_1);
+}
+
+
+/**
+ * Calculate the 64 bit hash of a string.
+ *
+ * @param[in] str
+ *   The string to hash.
+ *
+ * @return
+ *   The hash value.
+ */
+static inline uint64_t
+mxstr_hash64(mxstr_t str)
+{
+    return mxstr_hash64_seed(str, 0);
+}
+
+
+/**
+ * Calculate the 128 bit hash of a string using a seed.
+ *
+ * The low 64 bits are the same as the result of mxstr_hash64_seed().
+ *
+ * @param[in] str
+ *   The string to hash.
+ *
+ * @param[in] seed
+ *   The seed. Different seeds give unrelated hash functions.
+ *
+ * @return
+ *   The hash value.
+ */
+static inline mxhash128_t
+mxstr_hash128_seed(mxstr_t str, uint64_t seed)
+{
+    mxhash128_t hash;
+    uint64_t    acc[8];
+    uint64_t    secret[MXHASH_SECRET_WORDS];
+
+    if (str.len <= MXHASH_SHORT_MAX) {
+        /* Two independent passes: a single short state has 64 bits. */
+        hash.low = mxhash_short(str.ptr, str.len, seed);
+        hash.high = mxhash_short(str.ptr, str.len, seed ^ MXHASH_P2);
+        return hash;
+    }
+
+    mxhash_secret_init(secret, seed);
+    mxhash_long(acc, str.ptr, str.len, secret);
+
+    hash.low = mxhash_merge(acc, &secret[1], str.len * MXHASH_PRIME64_1);
+    hash.high = mxhash_merge(acc, &secret[11], ~(str.len * MXHASH_PRIME64_2));
+
+    return hash;
+}
+
+
+/**
+ * Calculate the 128 bit hash of a string.
+ *
+ * @param[in] str
+ *   The string to hash.
+ *
+ * @return
+ *   The hash value.
+ */
+static inline mxhash128_t
+mxstr_hash128(mxstr_t str)
+{
+    return mxstr_hash128_seed(str, 0);
+}
+
+
+/*
+ * ----------------------------------------------------------------------
+ * Streaming
+ * ----------------------------------------------------------------------
+ */
+
+/**
+ * Initialize a streaming hash state.
+ *
+ * @param[out] state
+ *   The state to initialize. No resources are held, so no cleanup is
+ *   needed.
+ *
+ * @param[in] seed
+ *   The seed, as for mxstr_hash64_seed().
+ */
+static inline void
+mxhash_init(mxhash_t *state, uint64_t seed)
+{
+    mxhash_acc_init(state->acc);
+    mxhash_secret_init(state->secret, seed);
+    state->seed = seed;
+    state->total = 0;
+    state->stripe = 0;
+    state->buf_len = 0;
+}
+
+
+/**
+ * Add input to a streaming hash.
+ *
+ * @param[in,out] state
+ *   The hash state.
+ *
+ * @param[in] str
+ *   The next piece of input.
+ */
+static inline void
+mxhash_update(mxhash_t *state, mxstr_t str)
+{
+    const unsigned char *ptr = str.ptr;
+    size_t               len = str.len;
+    size_t               count;
+
+    state->total += len;
+
+    if (len <= MXHASH_SHORT_MAX - state->buf_len) {
+        memcpy(&state->buf[state->buf_len], ptr, len);
+        state->buf_len += len;
+        return;
+    }
+
+    /* There is input beyond the buffer, so all of it can be accumulated. */
+    if (state->buf_len > 0) {
+        count = MXHASH_SHORT_MAX - state->buf_len;
+        memcpy(&state->buf[state->buf_len], ptr, count);
+        ptr += count;
+        len -= count;
+        mxhash_stripes(state->acc, state->buf,
+                       MXHASH_SHORT_MAX / MXHASH_STRIPE, &state->stripe,
+                       state->secret);
+        memcpy(state->last, &state->buf[MXHASH_SHORT_MAX - MXHASH_STRIPE],
+               MXHASH_STRIPE);
+    }
+
+    /* Keep at least one byte back for the final stripe. */
+    if (len > MXHASH_STRIPE) {
+        count = (len - 1) / MXHASH_STRIPE;
+        mxhash_stripes(state->acc, ptr, count, &state->stripe,
+                       state->secret);
+        ptr += count * MXHASH_STRIPE;
+        len -= count * MXHASH_STRIPE;
+        memcpy(state->last, ptr - MXHASH_STRIPE, MXHASH_STRIPE);
+    }
+
+    memcpy(state->buf, ptr, len);
+    state->buf_len = len;
+}
+
+
+/**
+ * Add the contents of a buffer to a streaming hash.
+ *
+ * @param[in,out] state
+ *   The hash state.
+ *
+ * @param[in] buffer
+ *   The buffer. It is not modified, so may be reset and refilled with
+ *   the next piece of input.
+ */
+static inline void
+mxhash_update_buf(mxhash_t *state, mxbuf_t *buffer)
+{
+    mxhash_update(state, mxbuf_str(buffer));
+}
+
+
+/**
+ * Accumulate the buffered input and final stripe of a streaming hash of
+ * more than MXHASH_SHORT_MAX bytes.
+ *
+ * @param[in] state
+ *   The hash state.
+ *
+ * @param[out] acc
+ *   The final accumulators.
+ */
+static inline void
+mxhash_final_acc(const mxhash_t *state, uint64_t *acc)
+{
+    unsigned char last[MXHASH_STRIPE];
+    size_t        stripe = state->stripe;
+    size_t        len = state->buf_len;
+
+    memcpy(acc, state->acc, sizeof(state->acc));
+    mxhash_stripes(acc, state->buf, (len - 1) / MXHASH_STRIPE, &stripe,
+                   state->secret);
+
+    if (len >= MXHASH_STRIPE) {
+        memcpy(last, &state->buf[len - MXHASH_STRIPE], MXHASH_STRIPE);
+    } else {
+        memcpy(last, &state->last[len], MXHASH_STRIPE - len);
+        memcpy(&last[MXHASH_STRIPE - len], state->buf, len);
+    }
+
+    mxhash_stripe_scalar(acc, last, &state->secret[MXHASH_LAST_KEY]);
+}
+
+
+/**
+ * Get the 64 bit hash of the input added to a streaming hash.
+ *
+ * The state is not modified, so more input may be added afterwards.
+ *
+ * @param[in] state
+ *   The hash state.
+ *
+ * @return
+ *   The same value as mxstr_hash64_seed() of the concatenated input.
+ */
+static inline uint64_t
+mxhash_final64(const mxhash_t *state)
+{
+    uint64_t acc[8];
+
+    if (state->total <= MXHASH_SHORT_MAX) {
+        return mxhash_short(state->buf, state->buf_len, state->seed);
+    }
+
+    mxhash_final_acc(state, acc);
+
+    return mxhash_merge(acc, &state->secret[1],
+                        state->total * MXHASH_PRIME64_1);
+}
+
+
+/**
+ * Get the 128 bit hash of the input added to a streaming hash.
+ *
+ * The state is not modified, so more input may be added afterwards.
+ *
+ * @param[in] state
+ *   The hash state.
+ *
+ * @return
+ *   The same value as mxstr_hash128_seed() of the concatenated input.
+ */
+static inline mxhash128_t
+mxhash_final128(const mxhash_t *state)
+{
+    mxhash128_t hash;
+    uint64_t    acc[8];
+
+    if (state->total <= MXHASH_SHORT_MAX) {
+        hash.low = mxhash_short(state->buf, state->buf_len, state->seed);
+        hash.high = mxhash_short(state->buf, state->buf_len,
+                                 state->seed ^ MXHASH_P2);
+        return hash;
+    }
+
+    mxhash_final_acc(state, acc);
+
+    hash.low = mxhash_merge(acc, &state->secret[1],
+                            state->total * MXHASH_PRIME64_1);
+    hash.high = mxhash_merge(acc, &state->secret[11],
+                             ~(state->total * MXHASH_PRIME64_2));
+
+    return hash;
+}
+
+#endif
@@ -0,0 +1,540 @@
+/*
+ * ----------------------------------------------------------------------
+ * |\ /| mxjsonidx.h
+ * | X | JSON Structural Index
+ * |/ \|
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef MXJSONIDX_H
+#define MXJSONIDX_H
+
+#include "mxstr.h"
+
+
+/*
+ * ----------------------------------------------------------------------
+ * Structural index
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * The index is built a 64 character block at a time, following the
+ * first stage of simdjson (Langdale and Lemire, "Parsing Gigabytes of JSON
+ * per Second", 2019). For each block, bitmaps of the interesting
+ * characters are computed (one bit per character), and then combined
+ * using ordinary integer operations:
+ *
+ * - Escaped characters are those following an odd length run of
+ *   backslashes, which is computed using carries from an addition.
+ *
+ * - Unescaped quotes are turned into a mask of the characters inside
+ *   strings by a prefix XOR, computed as a carry-less multiplication by
+ *   all ones.
+ *
+ * - Structural characters and whitespace outside strings then determine
+ *   the token positions, which are extracted from the final bitmap.
+ *
+ * State carried between blocks (whether the previous block ended inside a
+ * string, after an escape, or in the middle of a value) makes the result
+ * independent of the block boundaries.
+ */
+
+
+/**
+ * A structural index of a JSON document.
+ *
+ * The index holds the offsets of the structural characters ({, }, [, ],
+ * : and ,), of the opening and closing quote of each string, and of the
+ * first character of each other value (numbers, true, false and null),
+ * in document order:
+ *
+ *     mxjsonidx_t index;
+ *
+ *     mxjsonidx_create(&index);
+ *     if (mxjsonidx_build(&index, doc)) {
+ *         for (idx = 0; idx < index.count; idx++) {
+ *             c = doc.ptr[index.offsets[idx]];
+ *             ...
+ *         }
+ *     }
+ *     mxjsonidx_free(&index);
+ *
+ * A parser can therefore move directly from token to token without
+ * skipping whitespace or scanning strings for their closing quote. The
+ * index does not validate the document beyond checking that all strings
+ * are terminated.
+ */
+typedef struct {
+    uint32_t *offsets;  /**< The token offsets */
+    size_t    count;    /**< The number of offsets */
+    size_t    capacity; /**< The allocated size of the offsets array */
+} mxjsonidx_t;
+
+
+/**
+ * The state carried between blocks.
+ */
+typedef struct {
+    uint64_t escaped;   /**< The first character of the block is escaped */
+    uint64_t in_string; /**< The block starts inside a string (all ones) */
+    uint64_t scalar;    /**< The previous block ended inside a value */
+} mxjsonidx_state_t;
+
+
+/**
+ * The character bitmaps of a block.
+ */
+typedef struct {
+    uint64_t quote;     /**< Quote characters */
+    uint64_t backslash; /**< Backslash characters */
+    uint64_t op;        /**< Structural characters */
+    uint64_t space;     /**< Whitespace characters */
+} mxjsonidx_masks_t;
+
+
+/**
+ * Initialise an index.
+ *
+ * @param[in] index
+ *   The index to initialise. mxjsonidx_free() must be called to free the
+ *   associated memory.
+ */
+static inline void
+mxjsonidx_create(mxjsonidx_t *index)
+{
+    memset(index, 0, sizeof(*index));
+}
+
+
+/**
+ * Free the memory associated with an index.
+ */
+static inline void
+mxjsonidx_free(mxjsonidx_t *index)
+{
+    mxutil_free(index->offsets);
+    memset(index, 0, sizeof(*index));
+}
+
+
+/**
+ * Ensure there is space for another block of offsets.
+ */
+static inline void
+mxjsonidx_require(mxjsonidx_t *index)
+{
+    if (index->capacity - index->count < 64) {
+        index->capacity = max(index->capacity * 2, index->count + 64);
+        index->offsets = mxutil_realloc(index->offsets,
+                                        index->capacity * sizeof(uint32_t));
+    }
+}
+
+
+/**
+ * Find the escaped characters of a block.
+ *
+ * @param[in] backslash
+ *   The backslash bitmap.
+ *
+ * @param[in,out] prev_escaped
+ *   Whether the first character of the block is escaped. Updated for the
+ *   next block.
+ *
+ * @return
+ *   The bitmap of escaped characters.
+ */
+static inline uint64_t
+mxjsonidx_escaped(uint64_t backslash, uint64_t *prev_escaped)
+{
+    const uint64_t even = 0x5555555555555555ULL;
+    uint64_t       escaped;
+    uint64_t       follows;
+    uint64_t       odd_starts;
+    uint64_t       even_seqs;
+
+    if (backslash == 0) {
+        escaped = *prev_escaped;
+        *prev_escaped = 0;
+        return escaped;
+    }
+
+    /* An escaped backslash does not start an escape. */
+    backslash &= ~*prev_escaped;
+    follows = (backslash << 1) | *prev_escaped;
+
+    /* Adding the starts of runs that begin on odd bits to the backslash
+     * mask carries through each such run, leaving a bit set after runs of
+     * even length. Runs starting on even bits are handled by the inverse. */
+    odd_starts = backslash & ~even & ~follows;
+    even_seqs = odd_starts + backslash;
+    *prev_escaped = (even_seqs < backslash);
+
+    return (even ^ (even_seqs << 1)) & follows;
+}
+
+
+/**
+ * Compute the prefix XOR of a bitmap (scalar implementation).
+ *
+ * Each bit of the result is the XOR of the bits at and below the same
+ * position, so that bits between pairs of set bits are set.
+ */
+static inline uint64_t
+mxjsonidx_prefix_xor_scalar(uint64_t bits)
+{
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+
+    return bits;
+}
+
+
+/**
+ * Compute the token bitmap of a block.
+ *
+ * @param[in,out] state
+ *   The state carried between blocks.
+ *
+ * @param[in] masks
+ *   The character bitmaps of the block.
+ *
+ * @param[in] in_string
+ *   The prefix XOR of the unescaped quotes, not including the carried
+ *   state.
+ *
+ * @param[in] quote
+ *   The unescaped quotes.
+ *
+ * @return
+ *   The token bitmap.
+ */
+static inline uint64_t
+mxjsonidx_tokens(mxjsonidx_state_t *state, const mxjsonidx_masks_t *masks,
+                 uint64_t in_string, uint64_t quote)
+{
+    uint64_t strings;
+    uint64_t scalar;
+    uint64_t starts;
+
+    /* in_string includes each opening quote but not the closing quote. */
+    in_string ^= state->in_string;
+    state->in_string = (uint64_t)((int64_t)in_string >> 63);
+    strings = in_string | quote;
+
+    scalar = ~(masks->op | masks->space | strings);
+    starts = scalar & ~((scalar << 1) | state->scalar);
+    state->scalar = scalar >> 63;
+
+    return (masks->op & ~strings) | quote | starts;
+}
+
+
+/**
+ * Add the offsets of the set bits of a token bitmap to an index.
+ *
+ * Offsets are written 8 at a time, so that the loop branches once per 8
+ * tokens rather than once per token. Entries written beyond the new count
+ * are ignored (mxjsonidx_require() ensures there is space for them).
+ */
+static inline void
+mxjsonidx_flatten(mxjsonidx_t *index, uint32_t base, uint64_t bits)
+{
+    uint32_t *offsets = &index->offsets[index->count];
+    size_t    count;
+    size_t    idx;
+    size_t    pos;
+
+    count = __builtin_popcountll(bits);
+    index->count += count;
+
+    for (idx = 0; idx < count; idx += 8) {
+        for (pos = 0; pos < 8; pos++) {
+            /* The top bit avoids counting zeros in an empty bitmap. */
+            offsets[idx + pos] = base + __builtin_ctzll(bits | (1ULL << 63));
+            bits &= bits - 1;
+        }
+    }
+}
+
+
+/**
+ * Compute the character bitmaps of a block (scalar implementation).
+ */
+static inline void
+mxjsonidx_masks_scalar(const unsigned char *ptr, mxjsonidx_masks_t *masks)
+{
+    uint64_t bit;
+    size_t   idx;
+
+    memset(masks, 0, sizeof(*masks));
+
+    for (idx = 0; idx < 64; idx++) {
+        bit = 1ULL << idx;
+
+        switch (ptr[idx]) {
+        case '"':
+            masks->quote |= bit;
+            break;
+        case '\\':
+            masks->backslash |= bit;
+            break;
+        case '{':
+        case '}':
+        case '[':
+        case ']':
+        case ':':
+        case ',':
+            masks->op |= bit;
+            break;
+        case ' ':
+        case '\t':
+        case '\n':
+        case '\r':
+            masks->space |= bit;
+            break;
+        }
+    }
+}
+
+
+/**
+ * Index a sequence of 64 character blocks (scalar kernel).
+ *
+ * @param[in] index
+ *   The index.
+ *
+ * @param[in,out] state
+ *   The state carried between blocks.
+ *
+ * @param[in] ptr
+ *   The first block.
+ *
+ * @param[in] blocks
+ *   The number of blocks.
+ *
+ * @param[in] base
+ *   The document offset of the first block.
+ */
+static inline void
+mxjsonidx_blocks_scalar(mxjsonidx_t *index, mxjsonidx_state_t *state,
+                        const unsigned char *ptr, size_t blocks, size_t base)
+{
+    mxjsonidx_masks_t masks;
+    uint64_t          quote;
+    size_t            idx;
+
+    for (idx = 0; idx < blocks; idx++, ptr += 64, base += 64) {
+        mxjsonidx_masks_scalar(ptr, &masks);
+
+        quote = masks.quote &
+            ~mxjsonidx_escaped(masks.backslash, &state->escaped);
+
+        mxjsonidx_require(index);
+        mxjsonidx_flatten(index, base, mxjsonidx_tokens(
+            state, &masks, mxjsonidx_prefix_xor_scalar(quote), quote));
+    }
+}
+
+
+#ifdef MXUTIL_SIMD_X86
+
+/**
+ * Compare the characters of a 32 character block with a character (AVX2).
+ */
+#define MXJSONIDX_EQ_AVX2(in_, c_)                                      \
+    _mm256_cmpeq_epi8((in_), _mm256_set1_epi8(c_))
+
+
+/**
+ * Compute the character bitmaps of a 32 character block (AVX2).
+ */
+MXUTIL_TARGET("avx2") static inline void
+mxjsonidx_masks32_avx2(const unsigned char *ptr, uint32_t *quote,
+                       uint32_t *backslash, uint32_t *op, uint32_t *space)
+{
+    __m256i in;
+
+    in = _mm256_loadu_si256((__m256i *)ptr);
+
+    *quote = _mm256_movemask_epi8(MXJSONIDX_EQ_AVX2(in, '"'));
+    *backslash = _mm256_movemask_epi8(MXJSONIDX_EQ_AVX2(in, '\\'));
+
+    /* '{' and '}' differ from '[' and ']' only in bit 5. */
+    *op = _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(
+        MXJSONIDX_EQ_AVX2(_mm256_or_si256(in, _mm256_set1_epi8(0x20)), '{'),
+        MXJSONIDX_EQ_AVX2(_mm256_or_si256(in, _mm256_set1_epi8(0x20)), '}')),
+        _mm256_or_si256(MXJSONIDX_EQ_AVX2(in, ':'),
+                        MXJSONIDX_EQ_AVX2(in, ','))));
+
+    *space = _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(
+        MXJSONIDX_EQ_AVX2(in, ' '), MXJSONIDX_EQ_AVX2(in, '\t')),
+        _mm256_or_si256(MXJSONIDX_EQ_AVX2(in, '\n'),
+                        MXJSONIDX_EQ_AVX2(in, '\r'))));
+}
+
+
+/**
+ * Index a sequence of 64 character blocks (AVX2 and PCLMULQDQ kernel).
+ *
+ * See mxjsonidx_blocks_scalar().
+ */
+MXUTIL_TARGET("avx2,pclmul,popcnt,bmi") static inline void
+mxjsonidx_blocks_avx2(mxjsonidx_t *index, mxjsonidx_state_t *state,
+                      const unsigned char *ptr, size_t blocks, size_t base)
+{
+    mxjsonidx_masks_t masks;
+    uint32_t          lo[4];
+    uint32_t          hi[4];
+    uint64_t          quote;
+    uint64_t          in_string;
+    size_t            idx;
+
+    for (idx = 0; idx < blocks; idx++, ptr += 64, base += 64) {
+        mxjsonidx_masks32_avx2(ptr, &lo[0], &lo[1], &lo[2], &lo[3]);
+        mxjsonidx_masks32_avx2(ptr + 32, &hi[0], &hi[1], &hi[2], &hi[3]);
+
+        masks.quote = lo[0] | ((uint64_t)hi[0] << 32);
+        masks.backslash = lo[1] | ((uint64_t)hi[1] << 32);
+        masks.op = lo[2] | ((uint64_t)hi[2] << 32);
+        masks.space = lo[3] | ((uint64_t)hi[3] << 32);
+
+        quote = masks.quote &
+            ~mxjsonidx_escaped(masks.backslash, &state->escaped);
+
+        in_string = (uint64_t)_mm_cvtsi128_si64(_mm_clmulepi64_si128(
+            _mm_set_epi64x(0, (int64_t)quote), _mm_set1_epi8(-1), 0));
+
+        mxjsonidx_require(index);
+        mxjsonidx_flatten(index, base,
+                          mxjsonidx_tokens(state, &masks, in_string, quote));
+    }
+}
+
+
+/**
+ * Compare the characters of a 64 character block with a character, giving
+ * a bitmap (AVX-512).
+ */
+#define MXJSONIDX_EQ_AVX512(in_, c_)                                    \
+    _mm512_cmpeq_epi8_mask((in_), _mm512_set1_epi8(c_))
+
+
+/**
+ * Index a sequence of 64 character blocks (AVX-512 and PCLMULQDQ kernel).
+ *
+ * See mxjsonidx_blocks_scalar().
+ */
+MXUTIL_TARGET("avx512f,avx512bw,pclmul,popcnt,bmi") static inline void
+mxjsonidx_blocks_avx512(mxjsonidx_t *index, mxjsonidx_state_t *state,
+                        const unsigned char *ptr, size_t blocks, size_t base)
+{
+    mxjsonidx_masks_t masks;
+    __m512i           in;
+    __m512i           folded;
+    uint64_t          quote;
+    uint64_t          in_string;
+    size_t            idx;
+
+    for (idx = 0; idx < blocks; idx++, ptr += 64, base += 64) {
+        in = _mm512_loadu_si512(ptr);
+        folded = _mm512_or_si512(in, _mm512_set1_epi8(0x20));
+
+        masks.quote = MXJSONIDX_EQ_AVX512(in, '"');
+        masks.backslash = MXJSONIDX_EQ_AVX512(in, '\\');
+        masks.op = MXJSONIDX_EQ_AVX512(folded, '{') |
+            MXJSONIDX_EQ_AVX512(folded, '}') |
+            MXJSONIDX_EQ_AVX512(in, ':') | MXJSONIDX_EQ_AVX512(in, ',');
+        masks.space = MXJSONIDX_EQ_AVX512(in, ' ') |
+            MXJSONIDX_EQ_AVX512(in, '\t') | MXJSONIDX_EQ_AVX512(in, '\n') |
+            MXJSONIDX_EQ_AVX512(in, '\r');
+
+        quote = masks.quote &
+            ~mxjsonidx_escaped(masks.backslash, &state->escaped);
+
+        in_string = (uint64_t)_mm_cvtsi128_si64(_mm_clmulepi64_si128(
+            _mm_set_epi64x(0, (int64_t)quote), _mm_set1_epi8(-1), 0));
+
+        mxjsonidx_require(index);
+        mxjsonidx_flatten(index, base,
+                          mxjsonidx_tokens(state, &masks, in_string, quote));
+    }
+}
+
+#endif
+
+
+/**
+ * Index a sequence of 64 character blocks.
+ */
+static inline void
+mxjsonidx_blocks(mxjsonidx_t *index, mxjsonidx_state_t *state,
+                 const unsigned char *ptr, size_t blocks, size_t base)
+{
+#ifdef MXUTIL_SIMD_X86
+    /* The kernels also use POPCNT and BMI1 to extract the offsets. */
+    bool extract = (mxutil_cpu_pclmul() && mxutil_cpu_popcnt() &&
+                    mxutil_cpu_bmi());
+
+    if (extract && mxutil_cpu_avx512bw()) {
+        mxjsonidx_blocks_avx512(index, state, ptr, blocks, base);
+        return;
+    } else if (extract && mxutil_cpu_avx2()) {
+        mxjsonidx_blocks_avx2(index, state, ptr, blocks, base);
+        return;
+    }
+#endif
+
+    mxjsonidx_blocks_scalar(index, state, ptr, blocks, base);
+}
+
+
+/**
+ * Build the structural index of a JSON document.
+ *
+ * @param[in] index
+ *   The index. Any previous contents are replaced.
+ *
+ * @param[in] doc
+ *   The document. Offsets are 32 bit, so the document must be less than
+ *   4GB.
+ *
+ * @return
+ *   Indicates whether the index was built. false is returned if the
+ *   document is too large, or ends inside a string.
+ */
+static inline bool
+mxjsonidx_build(mxjsonidx_t *index, mxstr_t doc)
+{
+    mxjsonidx_state_t state;
+    unsigned char     tail[64];
+    size_t            blocks;
+
+    index->count = 0;
+
+    if (doc.len > UINT32_MAX) {
+        return false;
+    }
+
+    memset(&state, 0, sizeof(state));
+    blocks = doc.len / 64;
+
+    mxjsonidx_blocks(index, &state, doc.ptr, blocks, 0);
+
+    /* Pad the final partial block with whitespace. */
+    if (doc.len % 64 != 0) {
+        memset(tail, ' ', sizeof(tail));
+        memcpy(tail, &doc.ptr[blocks * 64], doc.len % 64);
+        mxjsonidx_blocks(index, &state, tail, 1, blocks * 64);
+    }
+
+    return (state.in_string == 0);
+}
+
+
+#endif
@@ -0,0 +1,539 @@
+/*
+ * ----------------------------------------------------------------------
+ * |\ /| mxjsonstr.h
+ * | X | JSON String API
+ * |/ \|
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef MXJSONSTR_H
+#define MXJSONSTR_H
+
+#include "mxutf8.h"
+
+
+/*
+ * ----------------------------------------------------------------------
+ * Escaping
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * A character needs escaping if it is a quote, a backslash or a control
+ * character (0x00..0x1f), or optionally if it is not ASCII. Runs of
+ * characters that need no escaping are found using a set of kernels in
+ * the same way as mxstr_find_char(), and copied to the output in one go.
+ */
+
+
+/**
+ * Flags for mxbuf_write_json_escaped().
+ */
+enum {
+    MXSTR_JSON_ASCII = 1 << 0   /**< Escape non-ASCII characters as \uXXXX */
+};
+
+
+/**
+ * Find the first character that needs escaping (scalar kernel).
+ *
+ * @param[in] str
+ *   The string to search.
+ *
+ * @param[in] ascii
+ *   Whether non-ASCII characters need escaping.
+ *
+ * @return
+ *   The offset of the first character that needs escaping, or str.len if
+ *   there is none.
+ */
+static inline size_t
+mxstr_json_escape_find_scalar(mxstr_t str, bool ascii)
+{
+    const uint64_t quote = 0x0101010101010101ULL * '"';
+    const uint64_t backslash = 0x0101010101010101ULL * '\\';
+    const uint64_t high = ascii ? 0x8080808080808080ULL : 0;
+    uint64_t       word;
+    uint64_t       mask;
+    size_t         idx;
+
+    for (idx = 0; idx + 8 <= str.len; idx += 8) {
+        word = mxutil_load_u64le(&str.ptr[idx]);
+        mask = mxutil_swar_zero(word ^ quote) |
+            mxutil_swar_zero(word ^ backslash) |
+            mxutil_swar_zero(word & 0xe0e0e0e0e0e0e0e0ULL) | (word & high);
+        if (mask != 0) {
+            return idx + (__builtin_ctzll(mask) >> 3);
+        }
+    }
+
+    for (; idx < str.len; idx++) {
+        if (str.ptr[idx] < 0x20 || str.ptr[idx] == '"' ||
+            str.ptr[idx] == '\\' || (ascii && str.ptr[idx] >= 0x80)) {
+            return idx;
+        }
+    }
+
+    return str.len;
+}
+
+
+#ifdef MXUTIL_SIMD_X86
+
+/**
+ * Get the mask of characters that need escaping in a 16 character block.
+ */
+static inline unsigned
+mxstr_json_escape_mask_sse2(const unsigned char *ptr, bool ascii)
+{
+    __m128i in;
+
+    in = _mm_loadu_si128((__m128i *)ptr);
+
+    return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(
+        _mm_cmpeq_epi8(in, _mm_set1_epi8('"')),
+        _mm_cmpeq_epi8(in, _mm_set1_epi8('\\'))),
+        _mm_cmpeq_epi8(_mm_min_epu8(in, _mm_set1_epi8(0x1f)), in))) |
+        (ascii ? _mm_movemask_epi8(in) : 0);
+}
+
+
+/**
+ * Find the first character that needs escaping (SSE2 kernel).
+ *
+ * The string must be at least 16 characters long.
+ */
+static inline size_t
+mxstr_json_escape_find_sse2(mxstr_t str, bool ascii)
+{
+    unsigned mask;
+    size_t   idx;
+
+    assert(str.len >= 16);
+
+    for (idx = 0; idx + 16 <= str.len; idx += 16) {
+        mask = mxstr_json_escape_mask_sse2(&str.ptr[idx], ascii);
+        if (mask != 0) {
+            return idx + __builtin_ctz(mask);
+        }
+    }
+
+    /* Overlapping load for the tail. Earlier bytes are known not to match. */
+    if (idx < str.len) {
+        idx = str.len - 16;
+        mask = mxstr_json_escape_mask_sse2(&str.ptr[idx], ascii);
+        if (mask != 0) {
+            return idx + __builtin_ctz(mask);
+        }
+    }
+
+    return str.len;
+}
+
+
+/**
+ * Get the mask of characters that need escaping in a 32 character block.
+ */
+MXUTIL_TARGET("avx2") static inline uint32_t
+mxstr_json_escape_mask_avx2(const unsigned char *ptr, bool ascii)
+{
+    __m256i in;
+
+    in = _mm256_loadu_si256((__m256i *)ptr);
+
+    return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(
+        _mm256_cmpeq_epi8(in, _mm256_set1_epi8('"')),
+        _mm256_cmpeq_epi8(in, _mm256_set1_epi8('\\'))),
+        _mm256_cmpeq_epi8(_mm256_min_epu8(in, _mm256_set1_epi8(0x1f)), in))) |
+        (ascii ? (uint32_t)_mm256_movemask_epi8(in) : 0);
+}
+
+
+/**
+ * Find the first character that needs escaping (AVX2 kernel).
+ *
+ * The string must be at least 32 characters long.
+ */
+MXUTIL_TARGET("avx2") static inline size_t
+mxstr_json_escape_find_avx2(mxstr_t str, bool ascii)
+{
+    uint32_t mask;
+    size_t   idx;
+
+    assert(str.len >= 32);
+
+    for (idx = 0; idx + 32 <= str.len; idx += 32) {
+        mask = mxstr_json_escape_mask_avx2(&str.ptr[idx], ascii);
+        if (mask != 0) {
+            return idx + __builtin_ctz(mask);
+        }
+    }
+
+    if (idx < str.len) {
+        idx = str.len - 32;
+        mask = mxstr_json_escape_mask_avx2(&str.ptr[idx], ascii);
+        if (mask != 0) {
+            return idx + __builtin_ctz(mask);
+        }
+    }
+
+    return str.len;
+}
+
+#endif
+
+
+/**
+ * Find the first character of a string that needs escaping.
+ *
+ * @return
+ *   The offset of the character, or str.len if there is none.
+ */
+static inline size_t
+mxstr_json_escape_find(mxstr_t str, bool ascii)
+{
+#ifdef MXUTIL_SIMD_X86
+    if (str.len >= 32 && mxutil_cpu_avx2()) {
+        return mxstr_json_escape_find_avx2(str, ascii);
+    } else if (str.len >= 16) {
+        return mxstr_json_escape_find_sse2(str, ascii);
+    }
+#endif
+
+    return mxstr_json_escape_find_scalar(str, ascii);
+}
+
+
+/**
+ * Write a \uXXXX escape for a UTF-16 code unit.
+ */
+static inline void
+mxstr_json_put_u16(mxstr_t *dest, uint32_t c)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    (void)mxstr_putc(dest, '\\');
+    (void)mxstr_putc(dest, 'u');
+    (void)mxstr_putc(dest, hex[(c >> 12) & 0xf]);
+    (void)mxstr_putc(dest, hex[(c >> 8) & 0xf]);
+    (void)mxstr_putc(dest, hex[(c >> 4) & 0xf]);
+    (void)mxstr_putc(dest, hex[c & 0xf]);
+}
+
+
+/**
+ * Write the JSON escape sequence for a codepoint to a buffer.
+ *
+ * Codepoints above U+FFFF are written as an escaped surrogate pair.
+ */
+static inline void
+mxbuf_json_escape(mxbuf_t *buffer, uint32_t c)
+{
+    char    esc[12];
+    mxstr_t out = mxstr(esc, sizeof(esc));
+
+    switch (c) {
+    case '"':
+    case '\\':
+        (void)mxstr_putc(&out, '\\');
+        (void)mxstr_putc(&out, c);
+        break;
+    case '\b':
+        (void)mxstr_write(&out, mxstr_literal("\\b"));
+        break;
+    case '\f':
+        (void)mxstr_write(&out, mxstr_literal("\\f"));
+        break;
+    case '\n':
+        (void)mxstr_write(&out, mxstr_literal("\\n"));
+        break;
+    case '\r':
+        (void)mxstr_write(&out, mxstr_literal("\\r"));
+        break;
+    case '\t':
+        (void)mxstr_write(&out, mxstr_literal("\\t"));
+        break;
+    default:
+        if (c >= 0x10000) {
+            mxstr_json_put_u16(&out, 0xd800 + ((c - 0x10000) >> 10));
+            mxstr_json_put_u16(&out, 0xdc00 + (c & 0x3ff));
+        } else {
+            mxstr_json_put_u16(&out, c);
+        }
+        break;
+    }
+
+    (void)mxbuf_write(buffer, mxstr_prefix(mxstr(esc, sizeof(esc)), out));
+}
+
+
+/**
+ * Write a string to a buffer, escaped for use as a JSON string.
+ *
+ * The surrounding quotes are not written. For example:
+ *
+ *     mxbuf_putc(&buf, '"');
+ *     mxbuf_write_json_escaped(&buf, str, 0);
+ *     mxbuf_putc(&buf, '"');
+ *
+ * Quotes, backslashes and control characters are escaped, using the short
+ * forms (e.g. \n) where JSON has them. Other characters are copied
+ * unchanged, unless MXSTR_JSON_ASCII is set, in which case non-ASCII UTF-8
+ * sequences are written as \uXXXX escapes (any invalid UTF-8 is replaced
+ * with U+FFFD).
+ *
+ * @param[in] buffer
+ *   The buffer to write to.
+ *
+ * @param[in] str
+ *   The string to write.
+ *
+ * @param[in] flags
+ *   A combination of MXSTR_JSON_* flags, or 0.
+ *
+ * @return
+ *   The number of characters written.
+ */
+static inline size_t
+mxbuf_write_json_escaped(mxbuf_t *buffer, mxstr_t str, unsigned flags)
+{
+    bool     ascii = (flags & MXSTR_JSON_ASCII) != 0;
+    uint32_t c;
+    size_t   start;
+    size_t   idx;
+
+    start = mxbuf_str(buffer).len;
+
+    /* The output is at least as long as the input. */
+    mxbuf_require(buffer, str.len);
+
+    while (!mxstr_empty(str)) {
+        idx = mxstr_json_escape_find(str, ascii);
+        (void)mxbuf_write(buffer, mxstr((char *)str.ptr, idx));
+        (void)mxstr_consume(&str, idx);
+
+        if (mxstr_empty(str)) {
+            break;
+        }
+
+        if (str.ptr[0] >= 0x80) {
+            if (!mxstr_consume_utf8(&str, &c)) {
+                (void)mxstr_consume(&str, 1);
+                c = 0xfffd;
+            }
+        } else {
+            c = str.ptr[0];
+            (void)mxstr_consume(&str, 1);
+        }
+
+        mxbuf_json_escape(buffer, c);
+    }
+
+    return mxbuf_str(buffer).len - start;
+}
+
+
+/*
+ * ----------------------------------------------------------------------
+ * Unescaping
+ * ----------------------------------------------------------------------
+ */
+
+
+/**
+ * Parse the 4 hex digits of a \uXXXX escape.
+ *
+ * @param[in,out] str
+ *   The string. The digits are consumed if they are valid.
+ *
+ * @param[out] c
+ *   The code unit.
+ *
+ * @return
+ *   Indicates whether 4 hex digits were present.
+ */
+static inline bool
+mxstr_json_consume_hex4(mxstr_t *str, uint32_t *c)
+{
+    unsigned char digit;
+    uint32_t      value = 0;
+    size_t        idx;
+
+    if (str->len < 4) {
+        return false;
+    }
+
+    for (idx = 0; idx < 4; idx++) {
+        digit = str->ptr[idx];
+
+        if (digit >= '0' && digit <= '9') {
+            digit -= '0';
+        } else if ((digit | 0x20) >= 'a' && (digit | 0x20) <= 'f') {
+            digit = (digit | 0x20) - 'a' + 10;
+        } else {
+            return false;
+        }
+
+        value = (value << 4) | digit;
+    }
+
+    (void)mxstr_consume(str, 4);
+    *c = value;
+
+    return true;
+}
+
+
+/**
+ * Decode a JSON escape sequence.
+ *
+ * A \uXXXX escape of a high surrogate is combined with a following low
+ * surrogate escape. Unpaired surrogates are decoded as U+FFFD.
+ *
+ * @param[in,out] str
+ *   The string, starting with the backslash. The escape sequence is
+ *   consumed if it is valid.
+ *
+ * @param[out] c
+ *   The decoded codepoint.
+ *
+ * @return
+ *   Indicates whether the escape sequence was valid.
+ */
+static inline bool
+mxstr_json_consume_escape(mxstr_t *str, uint32_t *c)
+{
+    mxstr_t  pos = *str;
+    uint32_t low;
+
+    if (pos.len < 2) {
+        return false;
+    }
+
+    switch (pos.ptr[1]) {
+    case '"':
+    case '\\':
+    case '/':
+        *c = pos.ptr[1];
+        break;
+    case 'b':
+        *c = '\b';
+        break;
+    case 'f':
+        *c = '\f';
+        break;
+    case 'n':
+        *c = '\n';
+        break;
+    case 'r':
+        *c = '\r';
+        break;
+    case 't':
+        *c = '\t';
+        break;
+    case 'u':
+        (void)mxstr_consume(&pos, 2);
+        if (!mxstr_json_consume_hex4(&pos, c)) {
+            return false;
+        }
+
+        if ((*c & 0xf800) == 0xd800) {
+            if (*c < 0xdc00 &&
+                mxstr_consume_str(&pos, mxstr_literal("\\u"))) {
+                if (!mxstr_json_consume_hex4(&pos, &low)) {
+                    return false;
+                }
+
+                if ((low & 0xfc00) == 0xdc00) {
+                    *c = 0x10000 + ((*c - 0xd800) << 10) + (low - 0xdc00);
+                } else {
+                    /* Leave the second escape to be decoded separately. */
+                    pos.ptr -= 6;
+                    pos.len += 6;
+                    *c = 0xfffd;
+                }
+            } else {
+                *c = 0xfffd;
+            }
+        }
+
+        *str = pos;
+        return true;
+    default:
+        return false;
+    }
+
+    (void)mxstr_consume(str, 2);
+
+    return true;
+}
+
+
+/**
+ * Unescape the contents of a JSON string into a buffer.
+ *
+ * Backslashes are located using mxstr_find_char(), and the text between
+ * escape sequences is copied in one go. Most JSON strings contain no
+ * escapes at all, in which case nothing is copied and the input is
+ * returned as the result:
+ *
+ *     ok = mxbuf_write_json_unescaped(&scratch, raw, &value);
+ *
+ * @param[in] buffer
+ *   The buffer to write to. The buffer is not modified if the string
+ *   contains no escape sequences.
+ *
+ * @param[in] raw
+ *   The contents of the JSON string, without the surrounding quotes.
+ *
+ * @param[out] str
+ *   The unescaped string. This references either raw, or the characters
+ *   written to the end of the buffer (in which case it is only valid until
+ *   the buffer is next modified).
+ *
+ * @return
+ *   Indicates whether the string was unescaped. false is returned if the
+ *   string contains an invalid escape sequence, in which case the buffer
+ *   is left unchanged.
+ */
+static inline bool
+mxbuf_write_json_unescaped(mxbuf_t *buffer, mxstr_t raw, mxstr_t *str)
+{
+    mxstr_t  out;
+    uint32_t c;
+    size_t   start;
+    size_t   idx;
+
+    if (!mxstr_find_char(raw, '\\', &idx)) {
+        *str = raw;
+        return true;
+    }
+
+    start = mxbuf_str(buffer).len;
+
+    /* An escape sequence is never shorter than the UTF-8 it decodes to. */
+    mxbuf_require(buffer, raw.len);
+
+    do {
+        mxbuf_write_unsafe(buffer, mxstr((char *)raw.ptr, idx));
+        (void)mxstr_consume(&raw, idx);
+
+        if (!mxstr_json_consume_escape(&raw, &c)) {
+            buffer->available = buffer->buf;
+            (void)mxstr_consume(&buffer->available, start);
+            return false;
+        }
+
+        (void)mxstr_put_utf8(&buffer->available, c);
+    } while (mxstr_find_char(raw, '\\', &idx));
+
+    mxbuf_write_unsafe(buffer, raw);
+
+    out = mxbuf_str(buffer);
+    (void)mxstr_substr(out, start, out.len, str);
+
+    return true;
+}
+
+
+#endif
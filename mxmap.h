@@ -0,0 +1,166 @@
+/*
+ * ----------------------------------------------------------------------
+ * |\ /| mxmap.h
+ * | X | Memory Mapped Files
+ * |/ \|
+ * ----------------------------------------------------------------------
+ */
+
+/* ----------------------------------------------------------------------
+ * Note
+ *
+ * This API requires POSIX mmap(). Access pattern hints are ignored when
+ * the platform (or the selected feature test macros) does not provide
+ * them, e.g. MAP_POPULATE and MADV_HUGEPAGE are Linux specific.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef MXMAP_H
+#define MXMAP_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mxstr.h"
+
+
+/**
+ * Flags for mxstr_map_file().
+ */
+enum {
+    MXSTR_MAP_SEQUENTIAL = 1 << 0, /**< Expect sequential access */
+    MXSTR_MAP_WILLNEED   = 1 << 1, /**< Start reading the file ahead */
+    MXSTR_MAP_HUGEPAGE   = 1 << 2, /**< Use transparent huge pages */
+    MXSTR_MAP_POPULATE   = 1 << 3  /**< Read the whole file when mapping */
+};
+
+
+/**
+ * Map a file into memory as a read-only string.
+ *
+ * This allows a file to be parsed in place, without reading it into a
+ * buffer:
+ *
+ *     mxstr_t view;
+ *
+ *     if (mxstr_map_file(path, &view, MXSTR_MAP_SEQUENTIAL)) {
+ *         parse(view);
+ *         mxstr_unmap(view);
+ *     }
+ *
+ * The memory referenced by the string must not be written to.
+ *
+ * @param[in] path
+ *   The path of the file to map.
+ *
+ * @param[out] view
+ *   The contents of the file. An empty file results in an empty string.
+ *
+ * @param[in] flags
+ *   A combination of MXSTR_MAP_* flags, or 0. The access pattern flags
+ *   are hints; failure to apply them is not an error.
+ *
+ * @return
+ *   Indicates whether the file was mapped. On failure, errno is set.
+ */
+static inline bool
+mxstr_map_file(const char *path, mxstr_t *view, unsigned flags)
+{
+    struct stat st;
+    void       *ptr;
+    int         mmap_flags = MAP_PRIVATE;
+    int         open_flags = O_RDONLY;
+    int         fd;
+    int         err;
+
+#ifdef O_CLOEXEC
+    /* Do not leak the descriptor to a concurrent fork() and exec(). */
+    open_flags |= O_CLOEXEC;
+#endif
+
+    fd = open(path, open_flags);
+    if (fd < 0) {
+        return false;
+    }
+
+    if (fstat(fd, &st) != 0) {
+        err = errno;
+        close(fd);
+        errno = err;
+        return false;
+    }
+
+    if ((uintmax_t)st.st_size > SIZE_MAX) {
+        close(fd);
+        errno = EFBIG;
+        return false;
+    }
+
+    if (st.st_size == 0) {
+        close(fd);
+        *view = mxstr(NULL, 0);
+        return true;
+    }
+
+#ifdef MAP_POPULATE
+    if (flags & MXSTR_MAP_POPULATE) {
+        mmap_flags |= MAP_POPULATE;
+    }
+#endif
+
+    ptr = mmap(NULL, st.st_size, PROT_READ, mmap_flags, fd, 0);
+    err = errno;
+    close(fd);
+
+    if (ptr == MAP_FAILED) {
+        errno = err;
+        return false;
+    }
+
+#ifdef POSIX_MADV_SEQUENTIAL
+    if (flags & MXSTR_MAP_SEQUENTIAL) {
+        (void)posix_madvise(ptr, st.st_size, POSIX_MADV_SEQUENTIAL);
+    }
+
+    if (flags & MXSTR_MAP_WILLNEED) {
+        (void)posix_madvise(ptr, st.st_size, POSIX_MADV_WILLNEED);
+    }
+#endif
+
+#ifdef MADV_HUGEPAGE
+    if (flags & MXSTR_MAP_HUGEPAGE) {
+        (void)madvise(ptr, st.st_size, MADV_HUGEPAGE);
+    }
+#endif
+
+#if !defined(MAP_POPULATE) && !defined(POSIX_MADV_SEQUENTIAL) && \
+    !defined(MADV_HUGEPAGE)
+    /* None of the hints are available (e.g. strict ISO C builds). */
+    UNUSED(flags);
+#endif
+
+    *view = mxstr(ptr, st.st_size);
+
+    return true;
+}
+
+
+/**
+ * Unmap a file mapped using mxstr_map_file().
+ *
+ * @param[in] view
+ *   The string returned by mxstr_map_file().
+ */
+static inline void
+mxstr_unmap(mxstr_t view)
+{
+    if (view.len > 0) {
+        (void)munmap(view.ptr, view.len);
+    }
+}
+
+
+#endif
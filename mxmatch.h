@@ -0,0 +1,507 @@
+/*
+ * ----------------------------------------------------------------------
+ * |\ /| mxmatch.h
+ * | X | Multi-pattern String Matching
+ * |/ \|
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef MXMATCH_H
+#define MXMATCH_H
+
+#include "mxstr.h"
+
+
+/**
+ * The maximum number of patterns for which the Teddy SIMD matcher is used.
+ *
+ * Larger pattern sets are matched using an Aho-Corasick automaton.
+ */
+#define MXSTR_TEDDY_MAX 32
+
+
+/**
+ * The number of Teddy buckets. Each pattern is assigned to one bucket.
+ */
+#define MXSTR_TEDDY_BUCKETS 8
+
+
+/**
+ * Flag set in automaton transitions to states that have matches.
+ */
+#define MXSTR_MULTIMATCH_FLAG 0x80000000U
+
+
+/**
+ * Callback to report a match.
+ *
+ * @param[in] ctx
+ *   The context passed to mxstr_multimatch_scan().
+ *
+ * @param[in] pattern
+ *   The index of the matching pattern.
+ *
+ * @param[in] offset
+ *   The offset of the start of the match relative to the start of the
+ *   string being scanned.
+ *
+ * @return
+ *   true to continue scanning, false to stop.
+ */
+typedef bool (*mxstr_match_fn_t)(void *ctx, size_t pattern, size_t offset);
+
+
+/**
+ * A compiled set of literal patterns.
+ *
+ * Small pattern sets are matched using the Teddy algorithm: candidate
+ * positions are found using SIMD nibble lookups on the first few
+ * characters of each pattern, where patterns are grouped into buckets,
+ * and only candidates are compared in full.
+ *
+ * All pattern sets also compile an Aho-Corasick automaton, used for large
+ * pattern sets or when the CPU lacks AVX2. The transition table is a DFA
+ * over byte equivalence classes (all characters not used in any pattern
+ * share one class), with premultiplied state numbers so the inner loop is
+ * a single table lookup per character.
+ */
+typedef struct {
+    mxstr_t  *patterns;         /**< The patterns (referenced, not copied) */
+    size_t    count;            /**< The number of patterns */
+
+    bool      teddy;            /**< Whether the Teddy matcher is enabled */
+    size_t    teddy_len;        /**< Number of characters matched by Teddy */
+    uint8_t   teddy_lo[3][16];  /**< Low nibble bucket masks */
+    uint8_t   teddy_hi[3][16];  /**< High nibble bucket masks */
+    uint32_t  bucket_start[MXSTR_TEDDY_BUCKETS + 1]; /**< Bucket offsets */
+    uint32_t *bucket_list;      /**< Pattern indices sorted by bucket */
+
+    uint8_t   classes[256];     /**< Character equivalence classes */
+    uint32_t  nclasses;         /**< Number of equivalence classes */
+    uint32_t *delta;            /**< Transitions (premultiplied states) */
+    uint32_t *out_head;         /**< First match node for each state */
+    uint32_t *out_next;         /**< Next match node */
+} mxstr_multimatch_t;
+
+
+/**
+ * Build the Teddy bucket masks.
+ */
+static inline void
+mxstr_multimatch_create_teddy(mxstr_multimatch_t *mm)
+{
+    size_t   minlen = SIZE_MAX;
+    size_t   idx;
+    size_t   pos;
+    size_t   bucket;
+    size_t   k;
+    uint32_t tmp;
+    mxstr_t  pat;
+
+    for (idx = 0; idx < mm->count; idx++) {
+        if (mm->patterns[idx].len > 0) {
+            minlen = min(minlen, mm->patterns[idx].len);
+        }
+    }
+
+    mm->teddy = (mm->count > 0 && mm->count <= MXSTR_TEDDY_MAX &&
+                 minlen != SIZE_MAX && mxutil_cpu_avx2());
+
+    if (!mm->teddy) {
+        return;
+    }
+
+    mm->teddy_len = min(minlen, 3);
+    mm->bucket_list = mxutil_malloc(mm->count * sizeof(uint32_t));
+
+    /* Sort the patterns so that patterns with similar prefixes share a
+     * bucket, which keeps the bucket masks (and false positives) small. */
+    for (idx = 0; idx < mm->count; idx++) {
+        tmp = idx;
+        for (pos = idx;
+             pos > 0 && mxstr_cmp(mm->patterns[mm->bucket_list[pos - 1]],
+                                  mm->patterns[tmp]) > 0;
+             pos--) {
+            mm->bucket_list[pos] = mm->bucket_list[pos - 1];
+        }
+        mm->bucket_list[pos] = tmp;
+    }
+
+    for (bucket = 0; bucket <= MXSTR_TEDDY_BUCKETS; bucket++) {
+        mm->bucket_start[bucket] = bucket * mm->count / MXSTR_TEDDY_BUCKETS;
+    }
+
+    for (bucket = 0; bucket < MXSTR_TEDDY_BUCKETS; bucket++) {
+        for (idx = mm->bucket_start[bucket];
+             idx < mm->bucket_start[bucket + 1];
+             idx++) {
+            pat = mm->patterns[mm->bucket_list[idx]];
+            for (k = 0; pat.len > 0 && k < mm->teddy_len; k++) {
+                mm->teddy_lo[k][pat.ptr[k] & 0xf] |= 1 << bucket;
+                mm->teddy_hi[k][pat.ptr[k] >> 4] |= 1 << bucket;
+            }
+        }
+    }
+}
+
+
+/**
+ * Build the Aho-Corasick automaton.
+ */
+static inline void
+mxstr_multimatch_create_ac(mxstr_multimatch_t *mm)
+{
+    uint32_t  nclasses = 1;
+    size_t    total = 0;
+    size_t    nstates = 1;
+    size_t    idx;
+    size_t    pos;
+    size_t    head = 0;
+    size_t    tail = 0;
+    uint32_t *fail;
+    uint32_t *queue;
+    uint32_t  state;
+    uint32_t  next;
+    uint32_t  node;
+    uint32_t  c;
+    mxstr_t   pat;
+
+    for (idx = 0; idx < mm->count; idx++) {
+        pat = mm->patterns[idx];
+        total += pat.len;
+        for (pos = 0; pos < pat.len; pos++) {
+            mm->classes[pat.ptr[pos]] = 1;
+        }
+    }
+
+    for (c = 0; c < 256; c++) {
+        if (mm->classes[c] != 0) {
+            mm->classes[c] = nclasses++;
+        }
+    }
+
+    mm->nclasses = nclasses;
+    assert((total + 1) * nclasses < MXSTR_MULTIMATCH_FLAG);
+
+    /* State 0 is the root. It is never the target of a trie edge, so 0 is
+     * used for missing transitions while building the trie. */
+    mm->delta = mxutil_calloc((total + 1) * nclasses * sizeof(uint32_t));
+    mm->out_head = mxutil_calloc((total + 1) * sizeof(uint32_t));
+    mm->out_next = mxutil_calloc((mm->count + 1) * sizeof(uint32_t));
+    fail = mxutil_calloc((total + 1) * sizeof(uint32_t));
+    queue = mxutil_malloc((total + 1) * sizeof(uint32_t));
+
+    /* Match node n (1-based) reports pattern n - 1. */
+    for (idx = 0; idx < mm->count; idx++) {
+        pat = mm->patterns[idx];
+        if (pat.len == 0) {
+            continue;
+        }
+
+        state = 0;
+        for (pos = 0; pos < pat.len; pos++) {
+            c = mm->classes[pat.ptr[pos]];
+            next = mm->delta[state * nclasses + c];
+            if (next == 0) {
+                next = nstates++;
+                mm->delta[state * nclasses + c] = next;
+            }
+            state = next;
+        }
+
+        mm->out_next[idx + 1] = mm->out_head[state];
+        mm->out_head[state] = idx + 1;
+    }
+
+    for (c = 0; c < nclasses; c++) {
+        if (mm->delta[c] != 0) {
+            queue[tail++] = mm->delta[c];
+        }
+    }
+
+    /* Breadth first traversal to compute failure links, fill in missing
+     * transitions and append the matches of each state's failure state. */
+    while (head < tail) {
+        state = queue[head++];
+
+        node = mm->out_head[state];
+        if (node == 0) {
+            mm->out_head[state] = mm->out_head[fail[state]];
+        } else {
+            while (mm->out_next[node] != 0) {
+                node = mm->out_next[node];
+            }
+            mm->out_next[node] = mm->out_head[fail[state]];
+        }
+
+        for (c = 0; c < nclasses; c++) {
+            next = mm->delta[state * nclasses + c];
+            if (next != 0) {
+                fail[next] = mm->delta[fail[state] * nclasses + c];
+                queue[tail++] = next;
+            } else {
+                mm->delta[state * nclasses + c] =
+                    mm->delta[fail[state] * nclasses + c];
+            }
+        }
+    }
+
+    for (idx = 0; idx < nstates * nclasses; idx++) {
+        next = mm->delta[idx];
+        mm->delta[idx] = next * nclasses |
+            (mm->out_head[next] != 0 ? MXSTR_MULTIMATCH_FLAG : 0);
+    }
+
+    mm->delta = mxutil_realloc(mm->delta,
+                               nstates * nclasses * sizeof(uint32_t));
+    mm->out_head = mxutil_realloc(mm->out_head, nstates * sizeof(uint32_t));
+
+    mxutil_free(fail);
+    mxutil_free(queue);
+}
+
+
+/**
+ * Compile a set of patterns.
+ *
+ * Empty patterns are permitted, but never match.
+ *
+ * @param[in] mm
+ *   The matcher to initialise. mxstr_multimatch_free() must be called to
+ *   free the associated memory.
+ *
+ * @param[in] patterns
+ *   The patterns. The pattern memory is referenced and must remain valid
+ *   while the matcher is in use. The array itself is copied.
+ *
+ * @param[in] count
+ *   The number of patterns.
+ */
+static inline void
+mxstr_multimatch_create(mxstr_multimatch_t *mm, const mxstr_t *patterns,
+                        size_t count)
+{
+    memset(mm, 0, sizeof(*mm));
+
+    mm->count = count;
+    mm->patterns = mxutil_malloc(max(count, 1) * sizeof(mxstr_t));
+    if (count > 0) {
+        memcpy(mm->patterns, patterns, count * sizeof(mxstr_t));
+    }
+
+    mxstr_multimatch_create_teddy(mm);
+    mxstr_multimatch_create_ac(mm);
+}
+
+
+/**
+ * Free the memory associated with a matcher.
+ */
+static inline void
+mxstr_multimatch_free(mxstr_multimatch_t *mm)
+{
+    mxutil_free(mm->patterns);
+    mxutil_free(mm->bucket_list);
+    mxutil_free(mm->delta);
+    mxutil_free(mm->out_head);
+    mxutil_free(mm->out_next);
+    memset(mm, 0, sizeof(*mm));
+}
+
+
+/**
+ * Scan a string using the Aho-Corasick automaton.
+ */
+static inline size_t
+mxstr_multimatch_scan_ac(const mxstr_multimatch_t *mm, mxstr_t str,
+                         mxstr_match_fn_t fn, void *ctx)
+{
+    const uint32_t *delta = mm->delta;
+    uint32_t        state = 0;
+    uint32_t        node;
+    size_t          found = 0;
+    size_t          idx;
+    size_t          pattern;
+
+    for (idx = 0; idx < str.len; idx++) {
+        state = delta[state + mm->classes[str.ptr[idx]]];
+
+        if (state & MXSTR_MULTIMATCH_FLAG) {
+            state &= ~MXSTR_MULTIMATCH_FLAG;
+
+            for (node = mm->out_head[state / mm->nclasses];
+                 node != 0;
+                 node = mm->out_next[node]) {
+                pattern = node - 1;
+                found++;
+                if (!fn(ctx, pattern,
+                        idx + 1 - mm->patterns[pattern].len)) {
+                    return found;
+                }
+            }
+        }
+    }
+
+    return found;
+}
+
+
+/**
+ * Verify the Teddy candidates at a position.
+ *
+ * @param[out] stop
+ *   Set when the callback requests that scanning stops.
+ *
+ * @return
+ *   The number of matches reported.
+ */
+static inline size_t
+mxstr_teddy_verify(const mxstr_multimatch_t *mm, mxstr_t str, size_t pos,
+                   unsigned buckets, mxstr_match_fn_t fn, void *ctx,
+                   bool *stop)
+{
+    size_t  found = 0;
+    size_t  idx;
+    size_t  pattern;
+    int     bucket;
+    mxstr_t pat;
+
+    while (buckets != 0) {
+        bucket = __builtin_ctz(buckets);
+        buckets &= buckets - 1;
+
+        for (idx = mm->bucket_start[bucket];
+             idx < mm->bucket_start[bucket + 1];
+             idx++) {
+            pattern = mm->bucket_list[idx];
+            pat = mm->patterns[pattern];
+
+            if (pat.len > 0 && pat.len <= str.len - pos &&
+                memcmp(&str.ptr[pos], pat.ptr, pat.len) == 0) {
+                found++;
+                if (!fn(ctx, pattern, pos)) {
+                    *stop = true;
+                    return found;
+                }
+            }
+        }
+    }
+
+    return found;
+}
+
+
+#ifdef MXUTIL_SIMD_X86
+
+/**
+ * Scan a string using the Teddy matcher (AVX2 kernel).
+ */
+MXUTIL_TARGET("avx2") static inline size_t
+mxstr_multimatch_scan_teddy(const mxstr_multimatch_t *mm, mxstr_t str,
+                            mxstr_match_fn_t fn, void *ctx)
+{
+    const __m256i  nibble = _mm256_set1_epi8(0x0f);
+    const size_t   len = mm->teddy_len;
+    __m256i        lo[3];
+    __m256i        hi[3];
+    __m256i        res;
+    __m256i        in;
+    uint8_t        tail[64];
+    uint8_t        buckets[32];
+    const uint8_t *ptr;
+    uint32_t       valid;
+    uint32_t       mask;
+    size_t         found = 0;
+    size_t         idx;
+    size_t         k;
+    bool           stop = false;
+    int            bit;
+
+    for (k = 0; k < len; k++) {
+        lo[k] = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((__m128i *)mm->teddy_lo[k]));
+        hi[k] = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((__m128i *)mm->teddy_hi[k]));
+    }
+
+    for (idx = 0; idx < str.len && !stop; idx += 32) {
+        ptr = &str.ptr[idx];
+        valid = ~0U;
+
+        if (str.len - idx < 32 + len - 1) {
+            /* Zero pad the end of the string. Candidates are verified
+             * against the real string, so padding cannot cause a match. */
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, ptr, str.len - idx);
+            ptr = tail;
+            if (str.len - idx < 32) {
+                valid = (1U << (str.len - idx)) - 1;
+            }
+        }
+
+        res = _mm256_set1_epi8(-1);
+        for (k = 0; k < len; k++) {
+            in = _mm256_loadu_si256((__m256i *)&ptr[k]);
+            res = _mm256_and_si256(res, _mm256_and_si256(
+                _mm256_shuffle_epi8(lo[k], _mm256_and_si256(in, nibble)),
+                _mm256_shuffle_epi8(hi[k], _mm256_and_si256(
+                    _mm256_srli_epi16(in, 4), nibble))));
+        }
+
+        mask = ~_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(res, _mm256_setzero_si256())) & valid;
+
+        if (mask != 0) {
+            _mm256_storeu_si256((__m256i *)buckets, res);
+            while (mask != 0 && !stop) {
+                bit = __builtin_ctz(mask);
+                mask &= mask - 1;
+                found += mxstr_teddy_verify(mm, str, idx + bit, buckets[bit],
+                                            fn, ctx, &stop);
+            }
+        }
+    }
+
+    return found;
+}
+
+#endif
+
+
+/**
+ * Find all occurrences of the patterns in a string.
+ *
+ * Every occurrence of every pattern is reported, including overlapping
+ * occurrences and occurrences of one pattern within another. The order in
+ * which matches are reported is not specified.
+ *
+ * @param[in] mm
+ *   The matcher.
+ *
+ * @param[in] str
+ *   The string to scan.
+ *
+ * @param[in] fn
+ *   The callback to report each match to.
+ *
+ * @param[in] ctx
+ *   Context passed to the callback.
+ *
+ * @return
+ *   The number of matches that were reported.
+ */
+static inline size_t
+mxstr_multimatch_scan(const mxstr_multimatch_t *mm, mxstr_t str,
+                      mxstr_match_fn_t fn, void *ctx)
+{
+#ifdef MXUTIL_SIMD_X86
+    if (mm->teddy) {
+        return mxstr_multimatch_scan_teddy(mm, str, fn, ctx);
+    }
+#endif
+
+    return mxstr_multimatch_scan_ac(mm, str, fn, ctx);
+}
+
+
+#endif
@@ -0,0 +1,300 @@
+/*
+ * ----------------------------------------------------------------------
+ * |\ /| mxreader.h
+ * | X | Streaming Input
+ * |/ \|
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef MXREADER_H
+#define MXREADER_H
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "mxstr.h"
+
+
+/**
+ * The default reader buffer size.
+ */
+#define MXREADER_SIZE 65536
+
+
+/**
+ * Callback to read more input.
+ *
+ * The callback writes data to the space provided, and updates the space
+ * to reference the remaining space, in the same way as mxstr_write().
+ *
+ * @param[in] ctx
+ *   The context passed when the reader was created.
+ *
+ * @param[in,out] space
+ *   The space to write to.
+ *
+ * @return
+ *   false if an error occurred. Returning true without writing any data
+ *   indicates the end of the input.
+ */
+typedef bool (*mxreader_fill_fn_t)(void *ctx, mxstr_t *space);
+
+
+/**
+ * A streaming reader.
+ *
+ * A reader holds a window of input data in a fixed size buffer, refilling
+ * it from a file descriptor or callback as the window is consumed. This
+ * allows input of any size to be parsed in constant memory using the
+ * usual string functions on the window:
+ *
+ *     mxreader_t reader;
+ *
+ *     mxreader_create_fd(&reader, fd, 0);
+ *     while (mxreader_require(&reader, 2)) {
+ *         if (mxstr_consume_str(&reader.window, mxstr_literal("\r\n"))) {
+ *             ...
+ *         }
+ *     }
+ *     mxreader_free(&reader);
+ *
+ * Data before the start of the window is discarded when the buffer is
+ * refilled. To keep a token that spans a refill (e.g. a string that is
+ * consumed a piece at a time), pin its start using mxreader_pin(). The
+ * buffer grows beyond its initial size only when a pinned token does not
+ * fit.
+ *
+ * The window must only be modified by consuming from its start.
+ */
+typedef struct {
+    mxstr_t            window; /**< The unconsumed input */
+    mxbuf_t            buf;    /**< The buffered input */
+    mxreader_fill_fn_t fill;   /**< Callback to read more input */
+    void              *ctx;    /**< Context for the callback */
+    size_t             pin;    /**< Offset of the pinned position */
+    bool               pinned; /**< Whether a position is pinned */
+    bool               eof;    /**< The end of the input was reached */
+    bool               error;  /**< An error occurred reading the input */
+} mxreader_t;
+
+
+/**
+ * Initialise a reader that reads input using a callback.
+ *
+ * @param[in] reader
+ *   The reader to initialise. mxreader_free() must be called to free the
+ *   associated memory.
+ *
+ * @param[in] fill
+ *   The callback used to read input.
+ *
+ * @param[in] ctx
+ *   Context passed to the callback.
+ *
+ * @param[in] size
+ *   The buffer size, or 0 for MXREADER_SIZE. This is the maximum amount
+ *   of input read by each call to the callback.
+ */
+static inline void
+mxreader_create(mxreader_t *reader, mxreader_fill_fn_t fill, void *ctx,
+                size_t size)
+{
+    memset(reader, 0, sizeof(*reader));
+
+    mxbuf_create(&reader->buf, NULL, 0);
+    mxbuf_require(&reader->buf, (size > 0) ? size : MXREADER_SIZE);
+
+    reader->window = reader->buf.available;
+    reader->window.len = 0;
+    reader->fill = fill;
+    reader->ctx = ctx;
+}
+
+
+/**
+ * Callback to read input from a file descriptor.
+ */
+static inline bool
+mxreader_fill_fd(void *ctx, mxstr_t *space)
+{
+    ssize_t len;
+
+    do {
+        len = read((int)(intptr_t)ctx, space->ptr, space->len);
+    } while (len < 0 && errno == EINTR);
+
+    if (len > 0) {
+        (void)mxstr_consume(space, len);
+    }
+
+    return (len >= 0);
+}
+
+
+/**
+ * Initialise a reader that reads input from a file descriptor.
+ *
+ * The file descriptor is not closed by mxreader_free().
+ *
+ * @param[in] reader
+ *   The reader to initialise.
+ *
+ * @param[in] fd
+ *   The file descriptor to read from.
+ *
+ * @param[in] size
+ *   The buffer size, or 0 for MXREADER_SIZE.
+ */
+static inline void
+mxreader_create_fd(mxreader_t *reader, int fd, size_t size)
+{
+    mxreader_create(reader, mxreader_fill_fd, (void *)(intptr_t)fd, size);
+}
+
+
+/**
+ * Free the memory associated with a reader.
+ */
+static inline void
+mxreader_free(mxreader_t *reader)
+{
+    mxbuf_free(&reader->buf);
+    memset(reader, 0, sizeof(*reader));
+}
+
+
+/**
+ * Pin the current position of a reader.
+ *
+ * Input from the pinned position onwards is kept when the buffer is
+ * refilled, until mxreader_unpin() is called.
+ */
+static inline void
+mxreader_pin(mxreader_t *reader)
+{
+    reader->pin = mxstr_substr_offset(reader->buf.buf, reader->window);
+    reader->pinned = true;
+}
+
+
+/**
+ * Get the input consumed since the pinned position.
+ *
+ * The string is only valid until the reader is next refilled.
+ */
+static inline mxstr_t
+mxreader_pinned(mxreader_t *reader)
+{
+    mxstr_t str;
+
+    assert(reader->pinned);
+
+    (void)mxstr_substr(reader->buf.buf, reader->pin,
+                       mxstr_substr_offset(reader->buf.buf, reader->window),
+                       &str);
+
+    return str;
+}
+
+
+/**
+ * Release the pinned position of a reader.
+ */
+static inline void
+mxreader_unpin(mxreader_t *reader)
+{
+    reader->pinned = false;
+}
+
+
+/**
+ * Read more input into a reader's window.
+ *
+ * Consumed (and unpinned) input is discarded to make space. If there is
+ * still no space, the buffer is grown.
+ *
+ * @param[in] reader
+ *   The reader.
+ *
+ * @return
+ *   Indicates whether any input was read. false is returned at the end of
+ *   the input or on error.
+ */
+static inline bool
+mxreader_fill(mxreader_t *reader)
+{
+    mxstr_t space;
+    size_t  keep;
+    size_t  start;
+    size_t  end;
+    size_t  len;
+
+    if (reader->eof || reader->error) {
+        return false;
+    }
+
+    start = mxstr_substr_offset(reader->buf.buf, reader->window);
+    end = start + reader->window.len;
+    assert(&reader->buf.buf.ptr[end] == reader->buf.available.ptr);
+
+    keep = reader->pinned ? reader->pin : start;
+
+    /* Discard consumed input by moving the kept input to the start. */
+    if (keep > 0) {
+        memmove(reader->buf.buf.ptr, &reader->buf.buf.ptr[keep], end - keep);
+        reader->buf.available = reader->buf.buf;
+        (void)mxstr_consume(&reader->buf.available, end - keep);
+        reader->pin -= min(reader->pin, keep);
+        start -= keep;
+    }
+
+    if (mxstr_empty(reader->buf.available)) {
+        mxbuf_require(&reader->buf, reader->buf.buf.len);
+    }
+
+    space = reader->buf.available;
+    if (!reader->fill(reader->ctx, &space)) {
+        reader->error = true;
+    }
+
+    len = mxstr_substr_offset(reader->buf.available, space);
+    reader->eof = (len == 0 && !reader->error);
+    mxbuf_commit(&reader->buf, len);
+
+    space = mxbuf_str(&reader->buf);
+    (void)mxstr_substr(space, start, space.len, &reader->window);
+
+    return (len > 0);
+}
+
+
+/**
+ * Ensure a reader's window contains a minimum amount of input.
+ *
+ * The reader is refilled as required.
+ *
+ * @param[in] reader
+ *   The reader.
+ *
+ * @param[in] len
+ *   The amount of input required.
+ *
+ * @return
+ *   Indicates whether the window contains at least len characters. false
+ *   is returned when the end of the input is reached first, or on error;
+ *   the window then contains whatever input remains.
+ */
+static inline bool
+mxreader_require(mxreader_t *reader, size_t len)
+{
+    while (reader->window.len < len) {
+        if (!mxreader_fill(reader)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+#endif
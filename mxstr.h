@@ -22,6 +22,7 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "mxarena.h"
 #include "mxutil.h"
 
 
@@ -50,6 +51,9 @@
  *     mxstr_t str = ...;
  *     printf("%.*s\n", (int)str.len, str.ptr);
  *
+ * When writing to a mxbuf_t, mxbuf_printf() (see mxfmt.h) accepts a
+ * mxstr_t argument directly for "%s".
+ *
  * Alternatively a null terminated string may be constructed:
  *
  *     mxstr_t str = ...;
@@ -230,265 +234,1733 @@ mxstr_cmp(mxstr_t str1, mxstr_t str2)
 
 /*
  * ----------------------------------------------------------------------
- * Read
+ * Search
  * ----------------------------------------------------------------------
  */
 
+/*
+ * The search functions are implemented using a set of kernels: a portable
+ * scalar kernel that processes 8 bytes at a time (SWAR), an SSE2 kernel and
+ * AVX2 and AVX-512 kernels that are selected at runtime when supported by
+ * the CPU.
+ *
+ * The kernels are not intended to be called directly. Each kernel returns
+ * the index of the matching character, or str.len when there is no match.
+ */
+
 
 /**
- * Get the first character from a string.
- *
- * The return value indicates whether a character was present.
+ * Find the first instance of a character (scalar kernel).
  */
-static inline bool
-mxstr_getchar(mxstr_t str, unsigned char *c)
+static inline size_t
+mxstr_find_char_scalar(mxstr_t str, unsigned char c)
 {
-    bool ok;
-
-    ok = (str.len > 0);
+    const uint64_t pattern = 0x0101010101010101ULL * c;
+    uint64_t       mask;
+    size_t         idx;
+
+    for (idx = 0; idx + 8 <= str.len; idx += 8) {
+        mask = mxutil_swar_zero(mxutil_load_u64le(&str.ptr[idx]) ^ pattern);
+        if (mask != 0) {
+            return idx + (__builtin_ctzll(mask) >> 3);
+        }
+    }
 
-    if (ok) {
-        *c = str.ptr[0];
+    for (; idx < str.len; idx++) {
+        if (str.ptr[idx] == c) {
+            return idx;
+        }
     }
 
-    return ok;
+    return str.len;
 }
 
 
 /**
- * Consume characters from the start of a string.
- *
- * @param[in,out] str
- *   The string. This is updated to remove the specified number of characters
- *   from the start of the string. If the string is shorter than the number of
- *   characters to remove, the empty string is returned.
- *
- * @param[in] len
- *   The number of characters to consume.
- *
- * @return
- *   The number of characters that were consumed.
+ * Find the last instance of a character (scalar kernel).
  */
 static inline size_t
-mxstr_consume(mxstr_t *str, size_t len)
+mxstr_rfind_char_scalar(mxstr_t str, unsigned char c)
 {
-    size_t size;
+    const uint64_t pattern = 0x0101010101010101ULL * c;
+    uint64_t       mask;
+    size_t         idx;
+
+    for (idx = str.len; idx >= 8; idx -= 8) {
+        mask = mxutil_swar_zero(mxutil_load_u64le(&str.ptr[idx - 8]) ^ pattern);
+        if (mask != 0) {
+            return idx - 8 + ((63 - __builtin_clzll(mask)) >> 3);
+        }
+    }
 
-    size = min(str->len, len);
-    str->ptr = &str->ptr[size];
-    str->len -= size;
+    while (idx > 0) {
+        idx--;
+        if (str.ptr[idx] == c) {
+            return idx;
+        }
+    }
 
-    return size;
+    return str.len;
 }
 
 
+#ifdef MXUTIL_SIMD_X86
+
 /**
- * Consume a matching character from the start of a string
+ * Find the first instance of a character (SSE2 kernel).
  *
- * For example, to consume a digit character:
+ * The string must be at least 16 characters long.
+ */
+static inline size_t
+mxstr_find_char_sse2(mxstr_t str, unsigned char c)
+{
+    const __m128i pattern = _mm_set1_epi8((char)c);
+    unsigned      mask;
+    size_t        idx;
+
+    assert(str.len >= 16);
+
+    for (idx = 0; idx + 16 <= str.len; idx += 16) {
+        mask = _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)&str.ptr[idx]),
+                           pattern));
+        if (mask != 0) {
+            return idx + __builtin_ctz(mask);
+        }
+    }
 
- *     ok = mxstr_consume_char(str, &c, isdigit(c));
- *     if (ok) {
- *         // c contains the matching digit character
- *     }
- *
- * @param[in,out] str_
- *   The string.
- *
- * @param[out] c_
- *   Auxiliary variable to store the character from the start of the string.
- *   Note: this variable is not set when the string is empty.
- *
- * @param[in] match_
- *   A boolean expression for the match condition. The first character from
- *   the string is only consumed if it matches this condition.
+    /* Overlapping load for the tail. Earlier bytes are known not to match. */
+    if (idx < str.len) {
+        idx = str.len - 16;
+        mask = _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)&str.ptr[idx]),
+                           pattern));
+        if (mask != 0) {
+            return idx + __builtin_ctz(mask);
+        }
+    }
+
+    return str.len;
+}
+
+
+/**
+ * Find the last instance of a character (SSE2 kernel).
  *
- * @return
- *   Indicates whether a matching character was consumed.
+ * The string must be at least 16 characters long.
  */
-#define mxstr_consume_char(str_, c_, match_)                            \
-    (mxstr_getchar(*(str_), (c_)) && (match_) &&                        \
-     mxstr_consume((str_), 1) == 1)
+static inline size_t
+mxstr_rfind_char_sse2(mxstr_t str, unsigned char c)
+{
+    const __m128i pattern = _mm_set1_epi8((char)c);
+    unsigned      mask;
+    size_t        idx;
+
+    assert(str.len >= 16);
+
+    for (idx = str.len; idx >= 16; idx -= 16) {
+        mask = _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)&str.ptr[idx - 16]),
+                           pattern));
+        if (mask != 0) {
+            return idx - 16 + (31 - __builtin_clz(mask));
+        }
+    }
+
+    if (idx > 0) {
+        mask = _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)str.ptr), pattern));
+        if (mask != 0) {
+            return 31 - __builtin_clz(mask);
+        }
+    }
+
+    return str.len;
+}
 
 
 /**
- * Consume 0 or more instances of matching characters from the start of a
- * string.
- *
- * For example, to remove any whitespace characters from the start of a
- * string:
- *
- *     mxstr_consume_chars(str, &c, isspace(c));
- *  * @param[in,out] str_
- *   The string to consume characters from.
+ * Find the first instance of a character (AVX2 kernel).
  *
- * @param c_
- *   Auxiliary variable which stores the last character to be checked.
- *   Note: this variable is not set when the string is empty.
- *
- * @param match_
- *   A boolean expression for the match condition. Characters matching
- *   this condition are consumed from the start of the string until the
- *   first character of the string does not match the condition.
+ * The string must be at least 32 characters long.
  */
-#define mxstr_consume_chars(str_, c_, match_)                           \
-    do {                                                                \
-        while (mxstr_consume_char(str_, c_, match_));                   \
-    } while(false)
+MXUTIL_TARGET("avx2") static inline size_t
+mxstr_find_char_avx2(mxstr_t str, unsigned char c)
+{
+    const __m256i pattern = _mm256_set1_epi8((char)c);
+    __m256i       eq0, eq1, eq2, eq3;
+    uint32_t      mask;
+    size_t        idx = 0;
+
+    assert(str.len >= 32);
+
+    /* Test 128 bytes per iteration, locating the match only on a hit. */
+    for (; idx + 128 <= str.len; idx += 128) {
+        eq0 = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((__m256i *)&str.ptr[idx]), pattern);
+        eq1 = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((__m256i *)&str.ptr[idx + 32]), pattern);
+        eq2 = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((__m256i *)&str.ptr[idx + 64]), pattern);
+        eq3 = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((__m256i *)&str.ptr[idx + 96]), pattern);
+
+        if (!_mm256_testz_si256(_mm256_or_si256(_mm256_or_si256(eq0, eq1),
+                                                _mm256_or_si256(eq2, eq3)),
+                                _mm256_set1_epi8(-1))) {
+            break;
+        }
+    }
+
+    for (; idx + 32 <= str.len; idx += 32) {
+        mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((__m256i *)&str.ptr[idx]), pattern));
+        if (mask != 0) {
+            return idx + __builtin_ctz(mask);
+        }
+    }
+
+    if (idx < str.len) {
+        idx = str.len - 32;
+        mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((__m256i *)&str.ptr[idx]), pattern));
+        if (mask != 0) {
+            return idx + __builtin_ctz(mask);
+        }
+    }
 
+    return str.len;
+}
 
 
 /**
- * Consume a matching prefix from the start of a string.
- *
- * For example, to consume "<header>" from the start of the string:
- *
- *     ok = mxstr_consume_str(str, mxstr_literal("<header>"));
- *     if (ok) {
- *         // a header tag was found
- *     }
- *
- * @param[in,out] str
- *   The string.
- *
- * @param[in] prefix
- *   The string to match. If str has a matching prefix, it is consumed.
+ * Find the last instance of a character (AVX2 kernel).
  *
- * @return
- *   Indicates whether a matching prefix was found and consumed.
+ * The string must be at least 32 characters long.
  */
-static inline bool
-mxstr_consume_str(mxstr_t *str, mxstr_t prefix)
+MXUTIL_TARGET("avx2") static inline size_t
+mxstr_rfind_char_avx2(mxstr_t str, unsigned char c)
 {
-    mxstr_t substr;
+    const __m256i pattern = _mm256_set1_epi8((char)c);
+    __m256i       eq0, eq1, eq2, eq3;
+    uint32_t      mask;
+    size_t        idx = str.len;
+
+    assert(str.len >= 32);
+
+    for (; idx >= 128; idx -= 128) {
+        eq0 = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((__m256i *)&str.ptr[idx - 32]), pattern);
+        eq1 = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((__m256i *)&str.ptr[idx - 64]), pattern);
+        eq2 = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((__m256i *)&str.ptr[idx - 96]), pattern);
+        eq3 = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((__m256i *)&str.ptr[idx - 128]), pattern);
+
+        if (!_mm256_testz_si256(_mm256_or_si256(_mm256_or_si256(eq0, eq1),
+                                                _mm256_or_si256(eq2, eq3)),
+                                _mm256_set1_epi8(-1))) {
+            break;
+        }
+    }
 
-    return (mxstr_substr(*str, 0, prefix.len, &substr) &&
-            mxstr_cmp(substr, prefix) == 0 &&
-            mxstr_consume(str, prefix.len) == prefix.len);
+    for (; idx >= 32; idx -= 32) {
+        mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((__m256i *)&str.ptr[idx - 32]), pattern));
+        if (mask != 0) {
+            return idx - 32 + (31 - __builtin_clz(mask));
+        }
+    }
+
+    if (idx > 0) {
+        mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((__m256i *)str.ptr), pattern));
+        if (mask != 0) {
+            return 31 - __builtin_clz(mask);
+        }
+    }
+
+    return str.len;
 }
 
 
-/*
- * ----------------------------------------------------------------------
- * Output
- * ----------------------------------------------------------------------
+/**
+ * Find the first instance of a character (AVX-512 kernel).
  */
+MXUTIL_TARGET("avx512f,avx512bw") static inline size_t
+mxstr_find_char_avx512(mxstr_t str, unsigned char c)
+{
+    const __m512i pattern = _mm512_set1_epi8((char)c);
+    __mmask64     mask;
+    size_t        idx;
+
+    for (idx = 0; idx + 64 <= str.len; idx += 64) {
+        mask = _mm512_cmpeq_epi8_mask(
+            _mm512_loadu_si512(&str.ptr[idx]), pattern);
+        if (mask != 0) {
+            return idx + __builtin_ctzll(mask);
+        }
+    }
 
-/*
- * Note: Typically string output is performed using mxbuf_t buffers rather
- * than strings. The string based functions here are used by the buffer
- * based API to write data to a string.
+    if (idx < str.len) {
+        mask = _mm512_cmpeq_epi8_mask(
+            _mm512_maskz_loadu_epi8(~0ULL >> (64 - (str.len - idx)),
+                                    &str.ptr[idx]),
+            pattern) & (~0ULL >> (64 - (str.len - idx)));
+        if (mask != 0) {
+            return idx + __builtin_ctzll(mask);
+        }
+    }
+
+    return str.len;
+}
+
+
+/**
+ * Find the last instance of a character (AVX-512 kernel).
  */
+MXUTIL_TARGET("avx512f,avx512bw") static inline size_t
+mxstr_rfind_char_avx512(mxstr_t str, unsigned char c)
+{
+    const __m512i pattern = _mm512_set1_epi8((char)c);
+    __mmask64     mask;
+    size_t        idx;
+
+    for (idx = str.len; idx >= 64; idx -= 64) {
+        mask = _mm512_cmpeq_epi8_mask(
+            _mm512_loadu_si512(&str.ptr[idx - 64]), pattern);
+        if (mask != 0) {
+            return idx - 64 + (63 - __builtin_clzll(mask));
+        }
+    }
+
+    if (idx > 0) {
+        mask = _mm512_cmpeq_epi8_mask(
+            _mm512_maskz_loadu_epi8(~0ULL >> (64 - idx), str.ptr),
+            pattern) & (~0ULL >> (64 - idx));
+        if (mask != 0) {
+            return 63 - __builtin_clzll(mask);
+        }
+    }
+
+    return str.len;
+}
+
+#endif
+
 
 /**
- * Write a string.
- *
- * The destination string is updated so that it references any remaining space
- * once the string has been written. A separate reference to the string
- * buffer being written must be kept to allow the written string to be
- * retrieved:
+ * Find the first instance of a character in a string.
  *
- *     char buffer[100];
- *     mxstr_t buf;
- *     mxstr_t available;
- *     mxstr_t str
+ * For example, to split a line at the first ':' character:
  *
- *     buf = mxstr(buffer, sizeof(buffer));
- *     available = buf;
+ *     if (mxstr_find_char(line, ':', &idx)) {
+ *         mxstr_substr(line, 0, idx, &name);
+ *         mxstr_substr(line, idx + 1, line.len, &value);
+ *     }
  *
- *     mxstr_write(&available, mxstr_literal("hello"));
- *     mxstr_write(&available, mxstr_literal(" ... goodbye"));
- *     str = mxstr_prefix(buf, available);
- *     // str contains "hello ... goodbye"
+ * @param[in] str
+ *   The string to search.
  *
- * @param[in,out] dest
- *   The string to write to. This is updated so that it references any
- *   remaining space not written to.
+ * @param[in] c
+ *   The character to search for.
  *
- * @param[in] src
- *   The string to write.
+ * @param[out] idx
+ *   The offset of the first matching character relative to the start of
+ *   the string. Not set when the character is not found.
  *
  * @return
- *   The number of characters that were written.
+ *   Indicates whether the character was found.
  */
-static inline size_t
-mxstr_write(mxstr_t *dest, mxstr_t src)
+static inline bool
+mxstr_find_char(mxstr_t str, unsigned char c, size_t *idx)
 {
-    size_t size;
+    size_t pos;
+
+#ifdef MXUTIL_SIMD_X86
+    if (str.len >= 64 && mxutil_cpu_avx512bw()) {
+        pos = mxstr_find_char_avx512(str, c);
+    } else if (str.len >= 32 && mxutil_cpu_avx2()) {
+        pos = mxstr_find_char_avx2(str, c);
+    } else if (str.len >= 16) {
+        pos = mxstr_find_char_sse2(str, c);
+    } else {
+        pos = mxstr_find_char_scalar(str, c);
+    }
+#else
+    pos = mxstr_find_char_scalar(str, c);
+#endif
 
-    size = min(dest->len, src.len);
-    memcpy(dest->ptr, src.ptr, size);
-    dest->ptr = &dest->ptr[size];
-    dest->len -= size;
+    if (pos < str.len) {
+        *idx = pos;
+    }
 
-    return size;
+    return (pos < str.len);
 }
 
 
 /**
- * Write repeated characters to a string.
+ * Find the last instance of a character in a string.
  *
- * @param[in,out] dest
- *   The string to write to. This is updated so that it references any
- *   remaining space not written to.
+ * @param[in] str
+ *   The string to search.
  *
  * @param[in] c
- *   The character to write to the destination string.
-
- * @param[in] n
- *   The number of times to write the character.
+ *   The character to search for.
+ *
+ * @param[out] idx
+ *   The offset of the last matching character relative to the start of
+ *   the string. Not set when the character is not found.
  *
  * @return
- *   The number of characters that were written.
+ *   Indicates whether the character was found.
  */
-static inline size_t
-mxstr_write_chars(mxstr_t *dest, unsigned char c, size_t n)
+static inline bool
+mxstr_rfind_char(mxstr_t str, unsigned char c, size_t *idx)
 {
-    size_t size;
+    size_t pos;
+
+#ifdef MXUTIL_SIMD_X86
+    if (str.len >= 64 && mxutil_cpu_avx512bw()) {
+        pos = mxstr_rfind_char_avx512(str, c);
+    } else if (str.len >= 32 && mxutil_cpu_avx2()) {
+        pos = mxstr_rfind_char_avx2(str, c);
+    } else if (str.len >= 16) {
+        pos = mxstr_rfind_char_sse2(str, c);
+    } else {
+        pos = mxstr_rfind_char_scalar(str, c);
+    }
+#else
+    pos = mxstr_rfind_char_scalar(str, c);
+#endif
 
-    size = min(dest->len, n);
-    memset(dest->ptr, c, size);
-    dest->ptr = &dest->ptr[size];
-    dest->len -= size;
+    if (pos < str.len) {
+        *idx = pos;
+    }
 
-    return size;
+    return (pos < str.len);
 }
 
 
 /**
- * Write a single character to a string.
+ * Get the suffix of a string starting at the first instance of a character.
  *
- * @param[in,out] str
- *   The string to write to. This is updated so that it references any
- *   remaining space not written to.
+ * This is the mxstr_t equivalent of strchr(). The part of the string
+ * before the character may be retrieved using mxstr_prefix():
+ *
+ *     value = mxstr_chr(str, ',');
+ *     field = mxstr_prefix(str, value);
+ *
+ * @param[in] str
+ *   The string to search.
  *
  * @param[in] c
- *   The character to write.
+ *   The character to search for.
  *
  * @return
- *   Indicates whether there was space to write the character.
+ *   The suffix of the string starting with the matching character. If the
+ *   character is not found, an empty string referencing the end of str is
+ *   returned.
  */
-static inline bool
-mxstr_putc(mxstr_t *str, unsigned char c)
+static inline mxstr_t
+mxstr_chr(mxstr_t str, unsigned char c)
 {
-    bool ok;
+    mxstr_t suffix;
+    size_t  idx = str.len;
 
-    ok = !mxstr_empty(*str);
+    (void)mxstr_find_char(str, c, &idx);
+    mxstr_substr(str, idx, str.len, &suffix);
 
-    if (ok) {
-        str->ptr[0] = c;
+    return suffix;
+}
+
+
+/**
+ * Get the suffix of a string starting at the last instance of a character.
+ *
+ * This is the mxstr_t equivalent of strrchr().
+ *
+ * @param[in] str
+ *   The string to search.
+ *
+ * @param[in] c
+ *   The character to search for.
+ *
+ * @return
+ *   The suffix of the string starting with the matching character. If the
+ *   character is not found, an empty string referencing the end of str is
+ *   returned.
+ */
+static inline mxstr_t
+mxstr_rchr(mxstr_t str, unsigned char c)
+{
+    mxstr_t suffix;
+    size_t  idx = str.len;
+
+    (void)mxstr_rfind_char(str, c, &idx);
+    mxstr_substr(str, idx, str.len, &suffix);
+
+    return suffix;
+}
+
+
+/*
+ * ----------------------------------------------------------------------
+ * Substring search
+ * ----------------------------------------------------------------------
+ */
+
+/**
+ * The maximum needle length searched for using the SIMD candidate filter.
+ *
+ * Longer needles are searched for using the Two-Way algorithm, which
+ * guarantees linear time in the length of the haystack.
+ */
+#define MXSTR_FIND_SHORT 32
+
+
+/**
+ * A Two-Way critical factorisation of a needle for one search direction.
+ */
+typedef struct {
+    size_t crit;                /**< Critical position */
+    size_t period;              /**< Period (or shift if not periodic) */
+    bool   periodic;            /**< Needle is periodic */
+} mxstr_twoway_t;
+
+
+/**
+ * A preprocessed needle for substring search.
+ *
+ * Use a finder when searching for the same needle in many haystacks so
+ * that the needle is only analysed once:
+ *
+ *     mxstr_finder_t finder;
+ *
+ *     mxstr_finder_create(&finder, mxstr_literal("\"id\":"));
+ *     for (...) {
+ *         if (mxstr_finder_find(&finder, record, &idx)) {
+ *             ...
+ *         }
+ *     }
+ *
+ * The finder references the needle memory, which must remain valid for
+ * as long as the finder is used.
+ */
+typedef struct {
+    mxstr_t        needle;      /**< The string to search for */
+    mxstr_twoway_t fwd;         /**< Factorisation for forward search */
+    mxstr_twoway_t rev;         /**< Factorisation for reverse search */
+} mxstr_finder_t;
+
+
+/*
+ * The Two-Way implementation works in either direction. A reverse search
+ * is a forward search for the reversed needle in the reversed haystack.
+ */
+
+
+/**
+ * Get a character of a string, indexed from the end if rev is set.
+ */
+static inline unsigned char
+mxstr_twoway_at(mxstr_t str, size_t idx, bool rev)
+{
+    return rev ? str.ptr[str.len - 1 - idx] : str.ptr[idx];
+}
+
+
+/**
+ * Compute the maximal suffix of a needle.
+ *
+ * @param[in] needle
+ *   The needle.
+ *
+ * @param[in] rev
+ *   Whether the needle is processed in reverse.
+ *
+ * @param[in] inverse
+ *   Whether the inverse alphabet ordering is used.
+ *
+ * @param[out] period
+ *   The period of the maximal suffix.
+ *
+ * @return
+ *   The position of the maximal suffix - 1 (SIZE_MAX for the whole needle).
+ */
+static inline size_t
+mxstr_twoway_max_suffix(mxstr_t needle, bool rev, bool inverse,
+                        size_t *period)
+{
+    size_t        suffix = SIZE_MAX;
+    size_t        j = 0;
+    size_t        k = 1;
+    size_t        p = 1;
+    unsigned char a;
+    unsigned char b;
+
+    while (j + k < needle.len) {
+        a = mxstr_twoway_at(needle, j + k, rev);
+        b = mxstr_twoway_at(needle, suffix + k, rev);
+
+        if (a == b) {
+            if (k != p) {
+                k++;
+            } else {
+                j += p;
+                k = 1;
+            }
+        } else if ((a < b) != inverse) {
+            j += k;
+            k = 1;
+            p = j - suffix;
+        } else {
+            suffix = j++;
+            k = p = 1;
+        }
+    }
+
+    *period = p;
+
+    return suffix;
+}
+
+
+/**
+ * Compute the critical factorisation of a needle.
+ *
+ * The needle must not be empty.
+ */
+static inline void
+mxstr_twoway_create(mxstr_twoway_t *tw, mxstr_t needle, bool rev)
+{
+    size_t suffix1, period1;
+    size_t suffix2, period2;
+    size_t idx;
+
+    suffix1 = mxstr_twoway_max_suffix(needle, rev, false, &period1);
+    suffix2 = mxstr_twoway_max_suffix(needle, rev, true, &period2);
+
+    if (suffix2 + 1 < suffix1 + 1) {
+        tw->crit = suffix1 + 1;
+        tw->period = period1;
+    } else {
+        tw->crit = suffix2 + 1;
+        tw->period = period2;
+    }
+
+    tw->periodic = (tw->crit + tw->period <= needle.len);
+
+    for (idx = 0; tw->periodic && idx < tw->crit; idx++) {
+        tw->periodic = (mxstr_twoway_at(needle, idx, rev) ==
+                        mxstr_twoway_at(needle, idx + tw->period, rev));
+    }
+
+    if (!tw->periodic) {
+        tw->period = max(tw->crit, needle.len - tw->crit) + 1;
+    }
+}
+
+
+/**
+ * Two-Way search.
+ *
+ * The needle must not be empty.
+ *
+ * @return
+ *   The position of the first match (in the search direction), or
+ *   haystack.len when there is no match.
+ */
+static inline size_t
+mxstr_twoway_find(const mxstr_twoway_t *tw, mxstr_t haystack, mxstr_t needle,
+                  bool rev)
+{
+    size_t memory = 0;
+    size_t i;
+    size_t j = 0;
+
+    while (haystack.len >= needle.len && j <= haystack.len - needle.len) {
+        /* Match the right half, starting after any remembered prefix. */
+        i = tw->periodic ? max(tw->crit, memory) : tw->crit;
+
+        while (i < needle.len &&
+               mxstr_twoway_at(needle, i, rev) ==
+               mxstr_twoway_at(haystack, i + j, rev)) {
+            i++;
+        }
+
+        if (i < needle.len) {
+            j += i - tw->crit + 1;
+            memory = 0;
+            continue;
+        }
+
+        /* Match the left half, right to left. */
+        i = tw->crit;
+
+        while (i > memory &&
+               mxstr_twoway_at(needle, i - 1, rev) ==
+               mxstr_twoway_at(haystack, i - 1 + j, rev)) {
+            i--;
+        }
+
+        if (i <= memory) {
+            return j;
+        }
+
+        j += tw->period;
+        memory = tw->periodic ? needle.len - tw->period : 0;
+    }
+
+    return haystack.len;
+}
+
+
+#ifdef MXUTIL_SIMD_X86
+
+/**
+ * Find the first instance of a short needle (AVX2 kernel).
+ *
+ * Candidate positions are found by comparing 32 positions at a time
+ * against the first and last characters of the needle. Only candidates
+ * matching both are compared in full.
+ *
+ * The needle must be 2..MXSTR_FIND_SHORT characters long and the haystack
+ * must contain at least 32 candidate positions.
+ */
+MXUTIL_TARGET("avx2") static inline size_t
+mxstr_find_avx2(mxstr_t haystack, mxstr_t needle)
+{
+    const __m256i first = _mm256_set1_epi8((char)needle.ptr[0]);
+    const __m256i last = _mm256_set1_epi8((char)needle.ptr[needle.len - 1]);
+    const size_t  end = haystack.len - needle.len + 1;
+    uint32_t      mask;
+    size_t        idx = 0;
+    size_t        pos;
+    int           bit;
+
+    assert(needle.len >= 2 && needle.len <= MXSTR_FIND_SHORT);
+    assert(end >= 32);
+
+    while (idx < end) {
+        pos = idx;
+        if (pos + 32 > end) {
+            /* Overlapping block for the tail, skipping checked positions. */
+            pos = end - 32;
+        }
+
+        mask = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(
+                first, _mm256_loadu_si256((__m256i *)&haystack.ptr[pos])),
+            _mm256_cmpeq_epi8(
+                last, _mm256_loadu_si256(
+                    (__m256i *)&haystack.ptr[pos + needle.len - 1]))));
+        mask &= ~0U << (idx - pos);
+
+        while (mask != 0) {
+            bit = __builtin_ctz(mask);
+            if (memcmp(&haystack.ptr[pos + bit + 1], &needle.ptr[1],
+                       needle.len - 2) == 0) {
+                return pos + bit;
+            }
+            mask &= mask - 1;
+        }
+
+        idx = pos + 32;
+    }
+
+    return haystack.len;
+}
+
+
+/**
+ * Find the last instance of a short needle (AVX2 kernel).
+ *
+ * The same constraints as mxstr_find_avx2() apply.
+ */
+MXUTIL_TARGET("avx2") static inline size_t
+mxstr_rfind_avx2(mxstr_t haystack, mxstr_t needle)
+{
+    const __m256i first = _mm256_set1_epi8((char)needle.ptr[0]);
+    const __m256i last = _mm256_set1_epi8((char)needle.ptr[needle.len - 1]);
+    size_t        idx = haystack.len - needle.len + 1;
+    uint32_t      mask;
+    size_t        pos;
+    int           bit;
+
+    assert(needle.len >= 2 && needle.len <= MXSTR_FIND_SHORT);
+    assert(idx >= 32);
+
+    while (idx > 0) {
+        pos = (idx >= 32) ? idx - 32 : 0;
+
+        mask = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(
+                first, _mm256_loadu_si256((__m256i *)&haystack.ptr[pos])),
+            _mm256_cmpeq_epi8(
+                last, _mm256_loadu_si256(
+                    (__m256i *)&haystack.ptr[pos + needle.len - 1]))));
+        mask &= ~0U >> (32 - (idx - pos));
+
+        while (mask != 0) {
+            bit = 31 - __builtin_clz(mask);
+            if (memcmp(&haystack.ptr[pos + bit + 1], &needle.ptr[1],
+                       needle.len - 2) == 0) {
+                return pos + bit;
+            }
+            mask &= ~(1U << bit);
+        }
+
+        idx = pos;
+    }
+
+    return haystack.len;
+}
+
+#endif
+
+
+/**
+ * Search using a kernel that does not require needle preprocessing.
+ *
+ * @param[out] pos
+ *   The position of the match, or haystack.len when there is no match.
+ *
+ * @return
+ *   Indicates whether the search was performed. If false, the Two-Way
+ *   search must be used.
+ */
+static inline bool
+mxstr_find_short(mxstr_t haystack, mxstr_t needle, bool rev, size_t *pos)
+{
+    bool done = true;
+
+    if (needle.len > haystack.len) {
+        *pos = haystack.len;
+    } else if (needle.len == 0) {
+        *pos = rev ? haystack.len : 0;
+    } else if (needle.len == 1) {
+        *pos = haystack.len;
+        if (rev) {
+            (void)mxstr_rfind_char(haystack, needle.ptr[0], pos);
+        } else {
+            (void)mxstr_find_char(haystack, needle.ptr[0], pos);
+        }
+#ifdef MXUTIL_SIMD_X86
+    } else if (needle.len <= MXSTR_FIND_SHORT &&
+               haystack.len - needle.len + 1 >= 32 &&
+               mxutil_cpu_avx2()) {
+        *pos = rev ? mxstr_rfind_avx2(haystack, needle) :
+                     mxstr_find_avx2(haystack, needle);
+#endif
+    } else {
+        done = false;
+    }
+
+    return done;
+}
+
+
+/**
+ * Search for a substring using a finder.
+ */
+static inline bool
+mxstr_finder_search(const mxstr_finder_t *finder, mxstr_t haystack, bool rev,
+                    size_t *idx)
+{
+    size_t pos;
+    bool   found;
+
+    if (!mxstr_find_short(haystack, finder->needle, rev, &pos)) {
+        pos = mxstr_twoway_find(rev ? &finder->rev : &finder->fwd,
+                                haystack, finder->needle, rev);
+        if (rev && pos < haystack.len) {
+            pos = haystack.len - finder->needle.len - pos;
+        }
+    }
+
+    found = (pos < haystack.len || finder->needle.len == 0);
+
+    if (found) {
+        *idx = pos;
+    }
+
+    return found;
+}
+
+
+/**
+ * Initialise a finder.
+ *
+ * @param[in] finder
+ *   The finder to initialise.
+ *
+ * @param[in] needle
+ *   The string to search for. The finder references this string, so the
+ *   memory must remain valid while the finder is in use.
+ */
+static inline void
+mxstr_finder_create(mxstr_finder_t *finder, mxstr_t needle)
+{
+    memset(finder, 0, sizeof(*finder));
+    finder->needle = needle;
+
+    if (needle.len > 0) {
+        mxstr_twoway_create(&finder->fwd, needle, false);
+        mxstr_twoway_create(&finder->rev, needle, true);
+    }
+}
+
+
+/**
+ * Find the first instance of a finder's needle in a string.
+ *
+ * @param[in] finder
+ *   The finder.
+ *
+ * @param[in] haystack
+ *   The string to search.
+ *
+ * @param[out] idx
+ *   The offset of the first match relative to the start of the haystack.
+ *   Not set when there is no match.
+ *
+ * @return
+ *   Indicates whether the needle was found. An empty needle is always found
+ *   at offset 0.
+ */
+static inline bool
+mxstr_finder_find(const mxstr_finder_t *finder, mxstr_t haystack, size_t *idx)
+{
+    return mxstr_finder_search(finder, haystack, false, idx);
+}
+
+
+/**
+ * Find the last instance of a finder's needle in a string.
+ *
+ * @param[in] finder
+ *   The finder.
+ *
+ * @param[in] haystack
+ *   The string to search.
+ *
+ * @param[out] idx
+ *   The offset of the last match relative to the start of the haystack.
+ *   Not set when there is no match.
+ *
+ * @return
+ *   Indicates whether the needle was found. An empty needle is always found
+ *   at offset haystack.len.
+ */
+static inline bool
+mxstr_finder_rfind(const mxstr_finder_t *finder, mxstr_t haystack,
+                   size_t *idx)
+{
+    return mxstr_finder_search(finder, haystack, true, idx);
+}
+
+
+/**
+ * Find the first instance of a substring in a string.
+ *
+ * This is the mxstr_t equivalent of strstr()/memmem(). When searching for
+ * the same needle repeatedly, mxstr_finder_find() avoids analysing the
+ * needle on each call.
+ *
+ * @param[in] haystack
+ *   The string to search.
+ *
+ * @param[in] needle
+ *   The string to search for.
+ *
+ * @param[out] idx
+ *   The offset of the first match relative to the start of the haystack.
+ *   Not set when there is no match.
+ *
+ * @return
+ *   Indicates whether the needle was found.
+ */
+static inline bool
+mxstr_find(mxstr_t haystack, mxstr_t needle, size_t *idx)
+{
+    mxstr_finder_t finder;
+    size_t         pos;
+
+    if (mxstr_find_short(haystack, needle, false, &pos)) {
+        if (pos < haystack.len || needle.len == 0) {
+            *idx = pos;
+            return true;
+        }
+        return false;
+    }
+
+    finder.needle = needle;
+    mxstr_twoway_create(&finder.fwd, needle, false);
+
+    return mxstr_finder_find(&finder, haystack, idx);
+}
+
+
+/**
+ * Find the last instance of a substring in a string.
+ *
+ * @param[in] haystack
+ *   The string to search.
+ *
+ * @param[in] needle
+ *   The string to search for.
+ *
+ * @param[out] idx
+ *   The offset of the last match relative to the start of the haystack.
+ *   Not set when there is no match.
+ *
+ * @return
+ *   Indicates whether the needle was found.
+ */
+static inline bool
+mxstr_rfind(mxstr_t haystack, mxstr_t needle, size_t *idx)
+{
+    mxstr_finder_t finder;
+    size_t         pos;
+
+    if (mxstr_find_short(haystack, needle, true, &pos)) {
+        if (pos < haystack.len || needle.len == 0) {
+            *idx = pos;
+            return true;
+        }
+        return false;
+    }
+
+    finder.needle = needle;
+    mxstr_twoway_create(&finder.rev, needle, true);
+
+    return mxstr_finder_rfind(&finder, haystack, idx);
+}
+
+
+/*
+ * ----------------------------------------------------------------------
+ * Read
+ * ----------------------------------------------------------------------
+ */
+
+
+/**
+ * Get the first character from a string.
+ *
+ * The return value indicates whether a character was present.
+ */
+static inline bool
+mxstr_getchar(mxstr_t str, unsigned char *c)
+{
+    bool ok;
+
+    ok = (str.len > 0);
+
+    if (ok) {
+        *c = str.ptr[0];
+    }
+
+    return ok;
+}
+
+
+/**
+ * Consume characters from the start of a string.
+ *
+ * @param[in,out] str
+ *   The string. This is updated to remove the specified number of characters
+ *   from the start of the string. If the string is shorter than the number of
+ *   characters to remove, the empty string is returned.
+ *
+ * @param[in] len
+ *   The number of characters to consume.
+ *
+ * @return
+ *   The number of characters that were consumed.
+ */
+static inline size_t
+mxstr_consume(mxstr_t *str, size_t len)
+{
+    size_t size;
+
+    size = min(str->len, len);
+    str->ptr = &str->ptr[size];
+    str->len -= size;
+
+    return size;
+}
+
+
+/**
+ * Consume a matching character from the start of a string
+ *
+ * For example, to consume a digit character:
+
+ *     ok = mxstr_consume_char(str, &c, isdigit(c));
+ *     if (ok) {
+ *         // c contains the matching digit character
+ *     }
+ *
+ * @param[in,out] str_
+ *   The string.
+ *
+ * @param[out] c_
+ *   Auxiliary variable to store the character from the start of the string.
+ *   Note: this variable is not set when the string is empty.
+ *
+ * @param[in] match_
+ *   A boolean expression for the match condition. The first character from
+ *   the string is only consumed if it matches this condition.
+ *
+ * @return
+ *   Indicates whether a matching character was consumed.
+ */
+#define mxstr_consume_char(str_, c_, match_)                            \
+    (mxstr_getchar(*(str_), (c_)) && (match_) &&                        \
+     mxstr_consume((str_), 1) == 1)
+
+
+/**
+ * Consume 0 or more instances of matching characters from the start of a
+ * string.
+ *
+ * For example, to remove any whitespace characters from the start of a
+ * string:
+ *
+ *     mxstr_consume_chars(str, &c, isspace(c));
+ *  * @param[in,out] str_
+ *   The string to consume characters from.
+ *
+ * @param c_
+ *   Auxiliary variable which stores the last character to be checked.
+ *   Note: this variable is not set when the string is empty.
+ *
+ * @param match_
+ *   A boolean expression for the match condition. Characters matching
+ *   this condition are consumed from the start of the string until the
+ *   first character of the string does not match the condition.
+ */
+#define mxstr_consume_chars(str_, c_, match_)                           \
+    do {                                                                \
+        while (mxstr_consume_char(str_, c_, match_));                   \
+    } while(false)
+
+
+
+/**
+ * Consume a matching prefix from the start of a string.
+ *
+ * For example, to consume "<header>" from the start of the string:
+ *
+ *     ok = mxstr_consume_str(str, mxstr_literal("<header>"));
+ *     if (ok) {
+ *         // a header tag was found
+ *     }
+ *
+ * @param[in,out] str
+ *   The string.
+ *
+ * @param[in] prefix
+ *   The string to match. If str has a matching prefix, it is consumed.
+ *
+ * @return
+ *   Indicates whether a matching prefix was found and consumed.
+ */
+static inline bool
+mxstr_consume_str(mxstr_t *str, mxstr_t prefix)
+{
+    mxstr_t substr;
+
+    return (mxstr_substr(*str, 0, prefix.len, &substr) &&
+            mxstr_cmp(substr, prefix) == 0 &&
+            mxstr_consume(str, prefix.len) == prefix.len);
+}
+
+
+/*
+ * ----------------------------------------------------------------------
+ * Character classes
+ * ----------------------------------------------------------------------
+ */
+
+/**
+ * A set of characters.
+ *
+ * A character class is a 256 bit bitmap, built once and then used to scan
+ * strings for runs of matching (or non-matching) characters. This is much
+ * faster than mxstr_consume_chars() with a match expression, which tests a
+ * single character per iteration:
+ *
+ *     mxstr_class_t space;
+ *
+ *     mxstr_class_create(&space, mxstr_literal(" \t\r\n"));
+ *     ...
+ *     (void)mxstr_consume_class(&str, &space);
+ *
+ * The bitmap layout is chosen to allow vectorised lookups (using PSHUFB)
+ * with the low nibble of the character as the table index: character c is
+ * a member when bit (c >> 4) & 7 of map[(c & 0xf) + ((c & 0x80) >> 3)]
+ * is set.
+ */
+typedef struct {
+    uint8_t map[32];            /**< Class bitmap */
+} mxstr_class_t;
+
+
+/**
+ * Add a character to a class.
+ */
+static inline void
+mxstr_class_add(mxstr_class_t *cls, unsigned char c)
+{
+    cls->map[(c & 0xf) + ((c & 0x80) >> 3)] |= 1 << ((c >> 4) & 7);
+}
+
+
+/**
+ * Add a range of characters to a class.
+ *
+ * @param[in] cls
+ *   The character class.
+ *
+ * @param[in] first
+ *   The first character of the range.
+ *
+ * @param[in] last
+ *   The last character of the range (inclusive).
+ */
+static inline void
+mxstr_class_add_range(mxstr_class_t *cls, unsigned char first,
+                      unsigned char last)
+{
+    unsigned c;
+
+    for (c = first; c <= last; c++) {
+        mxstr_class_add(cls, c);
+    }
+}
+
+
+/**
+ * Add each of the characters in a string to a class.
+ */
+static inline void
+mxstr_class_add_str(mxstr_class_t *cls, mxstr_t chars)
+{
+    size_t idx;
+
+    for (idx = 0; idx < chars.len; idx++) {
+        mxstr_class_add(cls, chars.ptr[idx]);
+    }
+}
+
+
+/**
+ * Invert a class, so that it matches exactly the characters it did not
+ * previously match.
+ */
+static inline void
+mxstr_class_invert(mxstr_class_t *cls)
+{
+    size_t idx;
+
+    for (idx = 0; idx < sizeof(cls->map); idx++) {
+        cls->map[idx] = ~cls->map[idx];
+    }
+}
+
+
+/**
+ * Test whether a character is a member of a class.
+ */
+static inline bool
+mxstr_class_match(const mxstr_class_t *cls, unsigned char c)
+{
+    return (cls->map[(c & 0xf) + ((c & 0x80) >> 3)] >> ((c >> 4) & 7)) & 1;
+}
+
+
+/**
+ * Initialise a class from a set of characters.
+ *
+ * @param[in] cls
+ *   The class to initialise.
+ *
+ * @param[in] chars
+ *   The characters in the class, e.g. mxstr_literal("0123456789").
+ */
+static inline void
+mxstr_class_create(mxstr_class_t *cls, mxstr_t chars)
+{
+    memset(cls, 0, sizeof(*cls));
+    mxstr_class_add_str(cls, chars);
+}
+
+
+/**
+ * Initialise a class from a predicate function.
+ *
+ * For example, to build a class of the whitespace characters as
+ * classified by isspace():
+ *
+ *     mxstr_class_create_pred(&space, isspace);
+ *
+ * @param[in] cls
+ *   The class to initialise.
+ *
+ * @param[in] pred
+ *   The predicate. Each character value 0..255 is a member of the class
+ *   when pred returns non-zero for it.
+ */
+static inline void
+mxstr_class_create_pred(mxstr_class_t *cls, int (*pred)(int))
+{
+    unsigned c;
+
+    memset(cls, 0, sizeof(*cls));
+
+    for (c = 0; c < 256; c++) {
+        if (pred(c)) {
+            mxstr_class_add(cls, c);
+        }
+    }
+}
+
+
+/*
+ * The class scanning kernels return the index of the first character
+ * whose class membership equals member, or str.len if there is none.
+ */
+
+
+/**
+ * Find the first (non-)member of a class (scalar kernel).
+ */
+static inline size_t
+mxstr_class_find_scalar(mxstr_t str, const mxstr_class_t *cls, bool member)
+{
+    size_t idx;
+
+    for (idx = 0; idx < str.len; idx++) {
+        if (mxstr_class_match(cls, str.ptr[idx]) == member) {
+            break;
+        }
+    }
+
+    return idx;
+}
+
+
+#ifdef MXUTIL_SIMD_X86
+
+/**
+ * Find the first (non-)member of a class (SSSE3 kernel).
+ *
+ * The string must be at least 16 characters long.
+ */
+MXUTIL_TARGET("ssse3") static inline size_t
+mxstr_class_find_ssse3(mxstr_t str, const mxstr_class_t *cls, bool member)
+{
+    const __m128i map0 = _mm_loadu_si128((__m128i *)&cls->map[0]);
+    const __m128i map1 = _mm_loadu_si128((__m128i *)&cls->map[16]);
+    const __m128i bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                       1, 2, 4, 8, 16, 32, 64, -128);
+    const unsigned flip = member ? 0 : 0xffff;
+    __m128i        in, idx8, row, bit;
+    unsigned       mask;
+    size_t         idx = 0;
+
+    assert(str.len >= 16);
+
+    for (;;) {
+        if (idx + 16 > str.len) {
+            if (idx == str.len) {
+                break;
+            }
+            /* Overlapping load for the tail. */
+            idx = str.len - 16;
+        }
+
+        in = _mm_loadu_si128((__m128i *)&str.ptr[idx]);
+
+        /* Index bytes with the top bit set produce 0 from PSHUFB, so each
+         * half of the map only contributes for its own range. */
+        idx8 = _mm_and_si128(in, _mm_set1_epi8((char)0x8f));
+        row = _mm_or_si128(
+            _mm_shuffle_epi8(map0, idx8),
+            _mm_shuffle_epi8(map1, _mm_xor_si128(idx8, _mm_set1_epi8(-128))));
+        bit = _mm_shuffle_epi8(
+            bits, _mm_and_si128(_mm_srli_epi16(in, 4), _mm_set1_epi8(0x0f)));
+
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(row, bit), bit));
+        mask ^= flip;
+
+        if (mask != 0) {
+            return idx + __builtin_ctz(mask);
+        }
+
+        idx += 16;
+    }
+
+    return str.len;
+}
+
+
+/**
+ * Find the first (non-)member of a class (AVX2 kernel).
+ *
+ * The string must be at least 32 characters long.
+ */
+MXUTIL_TARGET("avx2") static inline size_t
+mxstr_class_find_avx2(mxstr_t str, const mxstr_class_t *cls, bool member)
+{
+    const __m256i map0 = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((__m128i *)&cls->map[0]));
+    const __m256i map1 = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((__m128i *)&cls->map[16]));
+    const __m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                          1, 2, 4, 8, 16, 32, 64, -128,
+                                          1, 2, 4, 8, 16, 32, 64, -128,
+                                          1, 2, 4, 8, 16, 32, 64, -128);
+    const uint32_t flip = member ? 0 : 0xffffffff;
+    __m256i        in, idx8, row, bit;
+    uint32_t       mask;
+    size_t         idx = 0;
+
+    assert(str.len >= 32);
+
+    for (;;) {
+        if (idx + 32 > str.len) {
+            if (idx == str.len) {
+                break;
+            }
+            idx = str.len - 32;
+        }
+
+        in = _mm256_loadu_si256((__m256i *)&str.ptr[idx]);
+
+        idx8 = _mm256_and_si256(in, _mm256_set1_epi8((char)0x8f));
+        row = _mm256_or_si256(
+            _mm256_shuffle_epi8(map0, idx8),
+            _mm256_shuffle_epi8(map1,
+                                _mm256_xor_si256(idx8, _mm256_set1_epi8(-128))));
+        bit = _mm256_shuffle_epi8(
+            bits, _mm256_and_si256(_mm256_srli_epi16(in, 4),
+                                   _mm256_set1_epi8(0x0f)));
+
+        mask = _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_and_si256(row, bit), bit));
+        mask ^= flip;
+
+        if (mask != 0) {
+            return idx + __builtin_ctz(mask);
+        }
+
+        idx += 32;
+    }
+
+    return str.len;
+}
+
+#endif
+
+
+/**
+ * Find the first character whose class membership matches.
+ */
+static inline size_t
+mxstr_class_find(mxstr_t str, const mxstr_class_t *cls, bool member)
+{
+#ifdef MXUTIL_SIMD_X86
+    if (str.len >= 32 && mxutil_cpu_avx2()) {
+        return mxstr_class_find_avx2(str, cls, member);
+    } else if (str.len >= 16 && mxutil_cpu_ssse3()) {
+        return mxstr_class_find_ssse3(str, cls, member);
+    }
+#endif
+
+    return mxstr_class_find_scalar(str, cls, member);
+}
+
+
+/**
+ * Get the length of the prefix of a string consisting of characters in
+ * a class.
+ *
+ * This is the mxstr_t equivalent of strspn().
+ */
+static inline size_t
+mxstr_span_class(mxstr_t str, const mxstr_class_t *cls)
+{
+    return mxstr_class_find(str, cls, false);
+}
+
+
+/**
+ * Get the length of the prefix of a string consisting of characters not
+ * in a class.
+ *
+ * This is the mxstr_t equivalent of strcspn().
+ */
+static inline size_t
+mxstr_cspan_class(mxstr_t str, const mxstr_class_t *cls)
+{
+    return mxstr_class_find(str, cls, true);
+}
+
+
+/**
+ * Consume 0 or more characters in a class from the start of a string.
+ *
+ * This is equivalent to, but much faster than:
+ *
+ *     mxstr_consume_chars(str, &c, mxstr_class_match(cls, c));
+ *
+ * @param[in,out] str
+ *   The string to consume characters from.
+ *
+ * @param[in] cls
+ *   The character class.
+ *
+ * @return
+ *   The number of characters that were consumed.
+ */
+static inline size_t
+mxstr_consume_class(mxstr_t *str, const mxstr_class_t *cls)
+{
+    return mxstr_consume(str, mxstr_span_class(*str, cls));
+}
+
+
+/*
+ * ----------------------------------------------------------------------
+ * Output
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Note: Typically string output is performed using mxbuf_t buffers rather
+ * than strings. The string based functions here are used by the buffer
+ * based API to write data to a string.
+ */
+
+/**
+ * Write a string.
+ *
+ * The destination string is updated so that it references any remaining space
+ * once the string has been written. A separate reference to the string
+ * buffer being written must be kept to allow the written string to be
+ * retrieved:
+ *
+ *     char buffer[100];
+ *     mxstr_t buf;
+ *     mxstr_t available;
+ *     mxstr_t str
+ *
+ *     buf = mxstr(buffer, sizeof(buffer));
+ *     available = buf;
+ *
+ *     mxstr_write(&available, mxstr_literal("hello"));
+ *     mxstr_write(&available, mxstr_literal(" ... goodbye"));
+ *     str = mxstr_prefix(buf, available);
+ *     // str contains "hello ... goodbye"
+ *
+ * @param[in,out] dest
+ *   The string to write to. This is updated so that it references any
+ *   remaining space not written to.
+ *
+ * @param[in] src
+ *   The string to write.
+ *
+ * @return
+ *   The number of characters that were written.
+ */
+static inline size_t
+mxstr_write(mxstr_t *dest, mxstr_t src)
+{
+    size_t size;
+
+    size = min(dest->len, src.len);
+    memcpy(dest->ptr, src.ptr, size);
+    dest->ptr = &dest->ptr[size];
+    dest->len -= size;
+
+    return size;
+}
+
+
+/**
+ * Write repeated characters to a string.
+ *
+ * @param[in,out] dest
+ *   The string to write to. This is updated so that it references any
+ *   remaining space not written to.
+ *
+ * @param[in] c
+ *   The character to write to the destination string.
+
+ * @param[in] n
+ *   The number of times to write the character.
+ *
+ * @return
+ *   The number of characters that were written.
+ */
+static inline size_t
+mxstr_write_chars(mxstr_t *dest, unsigned char c, size_t n)
+{
+    size_t size;
+
+    size = min(dest->len, n);
+    memset(dest->ptr, c, size);
+    dest->ptr = &dest->ptr[size];
+    dest->len -= size;
+
+    return size;
+}
+
+
+/**
+ * Write a single character to a string.
+ *
+ * @param[in,out] str
+ *   The string to write to. This is updated so that it references any
+ *   remaining space not written to.
+ *
+ * @param[in] c
+ *   The character to write.
+ *
+ * @return
+ *   Indicates whether there was space to write the character.
+ */
+static inline bool
+mxstr_putc(mxstr_t *str, unsigned char c)
+{
+    bool ok;
+
+    ok = !mxstr_empty(*str);
+
+    if (ok) {
+        str->ptr[0] = c;
         (void)mxstr_consume(str, 1);
     }
 
-    return ok;
-}
+    return ok;
+}
+
+
+/**
+ * Get the length of the UTF-8 encoding of a unicode codepoint.
+ *
+ * @param[in] c
+ *   The codepoint.
+ *
+ * @return
+ *   The number of characters (1..4) needed to encode the codepoint, or 0 if
+ *   the codepoint is out of range.
+ */
+static inline size_t
+mxstr_utf8_len(uint32_t c)
+{
+    return (c < 0x80) ? 1 : (c < 0x800) ? 2 : (c < 0x10000) ? 3 :
+        (c < 0x110000) ? 4 : 0;
+}
+
+
+/**
+ * Write a UTF-8 encoded unicode codepoint to a string.
+ *
+ * @param[in,out] str
+ *   The string to write to. This is updated so that it references any
+ *   remaining space not written to.
+ *
+ * @param[in] c
+ *   The codepoint to write. This must be in the range 0..0x10ffff
+ *
+ * @return
+ *   Indicates whether the codepoint was written. false is returned if the
+ *   codepoint is out of range or there is not enough space to write it, in
+ *   which case nothing is written.
+ */
+static inline bool
+mxstr_put_utf8(mxstr_t *str, uint32_t c)
+{
+    unsigned char *ptr = str->ptr;
+    size_t         len;
+    bool           ok;
+
+    len = mxstr_utf8_len(c);
+    ok = (len > 0 && str->len >= len);
+
+    if (ok) {
+        if (len == 1) {
+            ptr[0] = c;
+        } else if (len == 2) {
+            ptr[0] = 0xc0 + ((c >> 6) & 0x1f);
+            ptr[1] = 0x80 + (c & 0x3f);
+        } else if (len == 3) {
+            ptr[0] = 0xe0 + ((c >> 12) & 0xf);
+            ptr[1] = 0x80 + ((c >> 6) & 0x3f);
+            ptr[2] = 0x80 + (c & 0x3f);
+        } else {
+            ptr[0] = 0xf0 + ((c >> 18) & 0x7);
+            ptr[1] = 0x80 + ((c >> 12) & 0x3f);
+            ptr[2] = 0x80 + ((c >> 6) & 0x3f);
+            ptr[3] = 0x80 + (c & 0x3f);
+        }
+        (void)mxstr_consume(str, len);
+    }
+
+    return ok;
+}
+
+
+/*
+ * ----------------------------------------------------------------------
+ * Buffer
+ * ----------------------------------------------------------------------
+ */
+
+
+/**
+ * Buffer growth policies.
+ *
+ * When a buffer needs more space, the new capacity is at least the space
+ * already used plus the space required. The growth policy determines how
+ * much additional space is allocated beyond that.
+ */
+typedef enum {
+    MXBUF_GROW_X2 = 0,  /**< Double the capacity, rounded to a power of 2 */
+    MXBUF_GROW_X1_5,    /**< Grow the capacity by 1.5x */
+    MXBUF_GROW_CHUNK,   /**< Round up to a multiple of a fixed chunk size */
+    MXBUF_GROW_CALLBACK /**< Use a caller supplied function */
+} mxbuf_growth_t;
+
 
+/**
+ * The minimum capacity allocated by the geometric growth policies.
+ */
+#define MXBUF_MIN_CAPACITY 16
 
-/*
- * ----------------------------------------------------------------------
- * Buffer
- * ----------------------------------------------------------------------
+
+/**
+ * Callback to calculate the new capacity of a buffer.
+ *
+ * @param[in] ctx
+ *   The context passed to mxbuf_growth_fn().
+ *
+ * @param[in] capacity
+ *   The current capacity of the buffer.
+ *
+ * @param[in] required
+ *   The minimum capacity required (space used plus space requested).
+ *
+ * @return
+ *   The new capacity. This must be at least required.
  */
+typedef size_t (*mxbuf_grow_fn_t)(void *ctx, size_t capacity, size_t required);
 
 
 /**
@@ -498,9 +1970,15 @@ mxstr_putc(mxstr_t *str, unsigned char c)
  * is required.
  */
 typedef struct {
-    mxstr_t buf;       /**< The current buffer to write to */
-    mxstr_t available; /**< The remaining space in the buffer */
-    mxstr_t init;      /**< The caller supplied buffer space to use */
+    mxstr_t         buf;       /**< The current buffer to write to */
+    mxstr_t         available; /**< The remaining space in the buffer */
+    mxstr_t         init;      /**< The caller supplied buffer space to use */
+    mxbuf_growth_t  growth;    /**< Growth policy */
+    size_t          chunk;     /**< Chunk size for MXBUF_GROW_CHUNK */
+    mxbuf_grow_fn_t grow_fn;   /**< Callback for MXBUF_GROW_CALLBACK */
+    void           *grow_ctx;  /**< Context for the growth callback */
+    const mxutil_allocator_t *allocator; /**< Allocator, NULL for global */
+    void           *allocator_ctx;       /**< Allocator context */
 } mxbuf_t;
 
 
@@ -512,6 +1990,9 @@ typedef struct {
  * It is valid to pass a zero-length block of memory - a new block of memory
  * is allocated as soon as any space is required.
  *
+ * The buffer uses the MXBUF_GROW_X2 growth policy. This may be changed
+ * using mxbuf_growth() or mxbuf_growth_fn().
+ *
  * @param[in] buffer
  *   The buffer to initialise
  *
@@ -526,12 +2007,104 @@ mxbuf_create(mxbuf_t *buffer, void *ptr, size_t len)
 {
     mxstr_t str = mxstr(ptr, len);
 
+    memset(buffer, 0, sizeof(*buffer));
     buffer->buf = str;
     buffer->available = str;
     buffer->init = str;
 }
 
 
+/**
+ * Set the allocator used by a buffer.
+ *
+ * By default buffers use the global allocator. This must be called before
+ * any memory has been allocated for the buffer.
+ *
+ * @param[in] buffer
+ *   The buffer.
+ *
+ * @param[in] allocator
+ *   The allocator, or NULL for the global allocator.
+ *
+ * @param[in] ctx
+ *   Context passed to the allocator functions.
+ */
+static inline void
+mxbuf_allocator(mxbuf_t *buffer, const mxutil_allocator_t *allocator,
+                void *ctx)
+{
+    assert(buffer->buf.ptr == buffer->init.ptr);
+
+    buffer->allocator = allocator;
+    buffer->allocator_ctx = ctx;
+}
+
+
+/**
+ * Initialise a buffer that allocates memory from an arena.
+ *
+ * The buffer memory is owned by the arena: it is released when the arena
+ * is reset or freed, and mxbuf_free() does not need to be called.
+ *
+ * @param[in] buffer
+ *   The buffer to initialise
+ *
+ * @param[in] arena
+ *   The arena to allocate buffer memory from.
+ */
+static inline void
+mxbuf_create_arena(mxbuf_t *buffer, mxarena_t *arena)
+{
+    mxbuf_create(buffer, NULL, 0);
+    mxbuf_allocator(buffer, mxarena_allocator(), arena);
+}
+
+
+/**
+ * Set the growth policy of a buffer.
+ *
+ * @param[in] buffer
+ *   The buffer.
+ *
+ * @param[in] growth
+ *   The growth policy. MXBUF_GROW_CALLBACK must be set using
+ *   mxbuf_growth_fn() instead.
+ *
+ * @param[in] chunk
+ *   The chunk size for MXBUF_GROW_CHUNK. Ignored by other policies.
+ */
+static inline void
+mxbuf_growth(mxbuf_t *buffer, mxbuf_growth_t growth, size_t chunk)
+{
+    assert(growth != MXBUF_GROW_CALLBACK);
+    assert(growth != MXBUF_GROW_CHUNK || chunk > 0);
+
+    buffer->growth = growth;
+    buffer->chunk = chunk;
+}
+
+
+/**
+ * Set a caller supplied growth policy for a buffer.
+ *
+ * @param[in] buffer
+ *   The buffer.
+ *
+ * @param[in] fn
+ *   Function used to calculate the new capacity when the buffer grows.
+ *
+ * @param[in] ctx
+ *   Context passed to fn.
+ */
+static inline void
+mxbuf_growth_fn(mxbuf_t *buffer, mxbuf_grow_fn_t fn, void *ctx)
+{
+    buffer->growth = MXBUF_GROW_CALLBACK;
+    buffer->grow_fn = fn;
+    buffer->grow_ctx = ctx;
+}
+
+
 /**
  * Reset a buffer to be empty.
  *
@@ -560,7 +2133,8 @@ static inline void
 mxbuf_free(mxbuf_t *buffer)
 {
     if (buffer->buf.ptr != buffer->init.ptr) {
-        free(buffer->buf.ptr);
+        mxutil_allocator_release(buffer->allocator, buffer->allocator_ctx,
+                                 buffer->buf.ptr, buffer->buf.len);
     }
 
     buffer->buf = buffer->init;
@@ -568,12 +2142,57 @@ mxbuf_free(mxbuf_t *buffer)
 }
 
 
+/**
+ * Move the contents of a buffer to a new block of memory.
+ *
+ * The block is allocated using the buffer's allocator. Any slack reported
+ * by the allocator's usable size is added to the buffer capacity.
+ *
+ * @param[in] buffer
+ *   The buffer.
+ *
+ * @param[in] new_size
+ *   The size of the new block. This must be at least the size of the
+ *   buffer contents, and not 0.
+ */
+static inline void
+mxbuf_resize(mxbuf_t *buffer, size_t new_size)
+{
+    mxstr_t  str;
+    size_t   len;
+    void    *ptr = NULL;
+
+    len = mxstr_substr_offset(buffer->buf, buffer->available);
+    assert(len <= new_size && new_size > 0);
+
+    if (buffer->buf.ptr != buffer->init.ptr) {
+        ptr = buffer->buf.ptr;
+    }
+
+    str.ptr = mxutil_allocator_resize(buffer->allocator, buffer->allocator_ctx,
+                                      ptr, (ptr != NULL) ? buffer->buf.len : 0,
+                                      new_size);
+    str.len = mxutil_allocator_usable_size(buffer->allocator,
+                                           buffer->allocator_ctx,
+                                           str.ptr, new_size);
+
+    /* Move any data written to the caller supplied memory. */
+    if (ptr == NULL && len > 0) {
+        memcpy(str.ptr, buffer->buf.ptr, len);
+    }
+
+    buffer->buf = str;
+    mxstr_substr(str, len, str.len, &buffer->available);
+}
+
+
 /**
  * Resize a buffer to remove any unused space.
  *
  * The resize is only performed when the current buffer has been allocated
  * by the buffer implementation. If the buffer is using the memory block
- * passed to mxbuf_create(), it is not modified.
+ * passed to mxbuf_create(), it is not modified. An empty buffer releases
+ * its memory and reverts to the block passed to mxbuf_create().
  *
  * @param[in] buffer
  *   The buffer.
@@ -581,22 +2200,84 @@ mxbuf_free(mxbuf_t *buffer)
 static inline void
 mxbuf_trim (mxbuf_t *buffer)
 {
-    mxstr_t str;
-    size_t  len;
+    size_t len;
 
     if (buffer->buf.ptr != buffer->init.ptr) {
         len = mxstr_substr_offset(buffer->buf, buffer->available);
-        str = mxstr(mxutil_realloc(buffer->buf.ptr, len), len);
-        buffer->buf = str;
-        mxstr_substr(str, len, len, &buffer->available);
+        if (len == 0) {
+            /* A zero size must not be passed to a resize. */
+            mxbuf_free(buffer);
+        } else {
+            mxbuf_resize(buffer, len);
+        }
+    }
+}
+
+
+/**
+ * Calculate the new capacity for a buffer using its growth policy.
+ *
+ * @param[in] buffer
+ *   The buffer.
+ *
+ * @param[in] required
+ *   The minimum capacity required.
+ *
+ * @return
+ *   The new capacity.
+ */
+static inline size_t
+mxbuf_grow_size(const mxbuf_t *buffer, size_t required)
+{
+    size_t capacity = buffer->buf.len;
+    size_t size;
+
+    switch (buffer->growth) {
+    case MXBUF_GROW_X1_5:
+        size = max(required, MXBUF_MIN_CAPACITY);
+        if (capacity <= SIZE_MAX / 3 * 2) {
+            size = max(size, capacity + capacity / 2);
+        }
+        break;
+
+    case MXBUF_GROW_CHUNK:
+        size = required;
+        if (size % buffer->chunk != 0) {
+            assert(size <= SIZE_MAX - buffer->chunk);
+            size += buffer->chunk - size % buffer->chunk;
+        }
+        break;
+
+    case MXBUF_GROW_CALLBACK:
+        size = buffer->grow_fn(buffer->grow_ctx, capacity, required);
+        break;
+
+    case MXBUF_GROW_X2:
+    default:
+        /* Capacity may include allocator slack, so round it down to a
+         * power of 2 before doubling. */
+        size = max(required, MXBUF_MIN_CAPACITY);
+        if (size <= (SIZE_MAX >> 1) + 1) {
+            size = mxutil_size_p2(size - 1);
+        }
+        if (capacity <= SIZE_MAX >> 1) {
+            size = max(size, mxutil_size_p2(capacity));
+        }
+        break;
     }
+
+    assert(size >= required);
+
+    return size;
 }
 
 
 /**
  * Ensure there is space available in a buffer.
  *
- * The buffer is resized if required.
+ * The buffer is resized if required. The new size is chosen by the
+ * buffer's growth policy, based on the space already used plus the
+ * additional space required.
  *
  * @param[in] buffer
  *   The buffer.
@@ -607,23 +2288,70 @@ mxbuf_trim (mxbuf_t *buffer)
 static inline void
 mxbuf_require(mxbuf_t *buffer, size_t size)
 {
-    size_t   new_size;
-    mxstr_t  str;
-    size_t   len;
-    void    *ptr = NULL;
+    size_t len;
 
     if (buffer->available.len < size) {
-        new_size = max(mxutil_size_p2(buffer->buf.len), mxutil_size_p2(size));
         len = mxstr_substr_offset(buffer->buf, buffer->available);
+        assert(size <= SIZE_MAX - len);
+        mxbuf_resize(buffer, mxbuf_grow_size(buffer, len + size));
+    }
+}
 
-        if (buffer->buf.ptr != buffer->init.ptr) {
-            ptr = buffer->buf.ptr;
-        }
 
-        str = mxstr(mxutil_realloc(ptr, new_size), new_size);
-        buffer->buf = str;
-        mxstr_substr(str, len, new_size, &buffer->available);
-    }
+/**
+ * Reserve space in a buffer to write to directly.
+ *
+ * This allows data to be produced directly in the buffer memory rather
+ * than being built elsewhere and copied in. Once the data has been
+ * written, mxbuf_commit() is used to add it to the buffer contents:
+ *
+ *     mxstr_t space;
+ *     ssize_t len;
+ *
+ *     space = mxbuf_reserve(&buf, 4096);
+ *     len = read(fd, space.ptr, space.len);
+ *     if (len > 0) {
+ *         mxbuf_commit(&buf, len);
+ *     }
+ *
+ * The reserved space is only valid until the next operation that may
+ * resize the buffer.
+ *
+ * @param[in] buffer
+ *   The buffer.
+ *
+ * @param[in] size
+ *   The minimum space to reserve.
+ *
+ * @return
+ *   The writable space at the end of the buffer. This is at least size
+ *   characters long, and may be longer.
+ */
+static inline mxstr_t
+mxbuf_reserve(mxbuf_t *buffer, size_t size)
+{
+    mxbuf_require(buffer, size);
+
+    return buffer->available;
+}
+
+
+/**
+ * Commit data written to space returned by mxbuf_reserve().
+ *
+ * @param[in] buffer
+ *   The buffer.
+ *
+ * @param[in] len
+ *   The number of characters written to the start of the reserved space.
+ *   This must not exceed the size of the reserved space.
+ */
+static inline void
+mxbuf_commit(mxbuf_t *buffer, size_t len)
+{
+    assert(len <= buffer->available.len);
+
+    (void)mxstr_consume(&buffer->available, len);
 }
 
 
@@ -692,27 +2420,16 @@ mxbuf_putc(mxbuf_t *buffer, unsigned char c)
 static inline bool
 mxbuf_put_utf8(mxbuf_t *buffer, uint32_t c)
 {
-    bool ok = true;
+    size_t len;
 
-    if (c < 0x80) {
-        (void)mxbuf_putc(buffer, c);
-    } else if (c < 0x800) {
-        (void)mxbuf_putc(buffer, 0xc0 + ((c >> 6) & 0x1f));
-        (void)mxbuf_putc(buffer, 0x80 + (c & 0x3f));
-    } else if (c < 0x10000) {
-        (void)mxbuf_putc(buffer, 0xe0 + ((c >> 12) & 0xf));
-        (void)mxbuf_putc(buffer, 0x80 + ((c >> 6) & 0x3f));
-        (void)mxbuf_putc(buffer, 0x80 + (c & 0x3f));
-    } else if (c < 0x110000) {
-        (void)mxbuf_putc(buffer, 0xf0 + ((c >> 18) & 0x7));
-        (void)mxbuf_putc(buffer, 0x80 + ((c >> 12) & 0x3f));
-        (void)mxbuf_putc(buffer, 0x80 + ((c >> 6) & 0x3f));
-        (void)mxbuf_putc(buffer, 0x80 + (c & 0x3f));
-    } else {
-        ok = false;
+    len = mxstr_utf8_len(c);
+    if (len == 0) {
+        return false;
     }
 
-    return ok;
+    mxbuf_require(buffer, len);
+
+    return mxstr_put_utf8(&buffer->available, c);
 }
 
 
@@ -742,6 +2459,156 @@ mxbuf_write_chars(mxbuf_t *buffer, unsigned char c, size_t n)
 }
 
 
+/*
+ * ----------------------------------------------------------------------
+ * Unchecked buffer output
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * The unchecked functions write to a buffer without checking for or
+ * allocating space. Space must first be reserved using mxbuf_require() or
+ * mxbuf_reserve(), allowing a single capacity check for a sequence of
+ * writes:
+ *
+ *     mxbuf_require(&buf, key.len + value.len + 2);
+ *     mxbuf_write_unsafe(&buf, key);
+ *     mxbuf_putc_unsafe(&buf, '=');
+ *     mxbuf_write_unsafe(&buf, value);
+ *     mxbuf_putc_unsafe(&buf, '\n');
+ *
+ * Writing more than the reserved space is only detected by assertions.
+ */
+
+
+/**
+ * Write a character to a buffer without checking for space.
+ *
+ * @param[in] buffer
+ *   The buffer to write to. At least 1 character of space must be
+ *   available.
+ *
+ * @param[in] c
+ *   The character to write.
+ */
+static inline void
+mxbuf_putc_unsafe(mxbuf_t *buffer, unsigned char c)
+{
+    assert(buffer->available.len >= 1);
+
+    buffer->available.ptr[0] = c;
+    buffer->available.ptr++;
+    buffer->available.len--;
+}
+
+
+/**
+ * Write a string to a buffer without checking for space.
+ *
+ * @param[in] buffer
+ *   The buffer to write to. At least str.len characters of space must be
+ *   available.
+ *
+ * @param[in] str
+ *   The string to write.
+ */
+static inline void
+mxbuf_write_unsafe(mxbuf_t *buffer, mxstr_t str)
+{
+    assert(buffer->available.len >= str.len);
+
+    memcpy(buffer->available.ptr, str.ptr, str.len);
+    buffer->available.ptr += str.len;
+    buffer->available.len -= str.len;
+}
+
+
+/**
+ * A writer for a block of space reserved in a buffer.
+ *
+ * A writer keeps its write position in a local variable rather than in
+ * the buffer, which allows the compiler to keep it in a register for the
+ * duration of a sequence of writes:
+ *
+ *     mxbuf_writer_t w;
+ *
+ *     mxbuf_writer_begin(&w, &buf, count * 2);
+ *     for (idx = 0; idx < count; idx++) {
+ *         mxbuf_writer_putc(&w, hex[data[idx] >> 4]);
+ *         mxbuf_writer_putc(&w, hex[data[idx] & 0xf]);
+ *     }
+ *     mxbuf_writer_end(&w);
+ *
+ * The buffer must not be modified between mxbuf_writer_begin() and
+ * mxbuf_writer_end().
+ */
+typedef struct {
+    mxbuf_t       *buffer;      /**< The buffer being written to */
+    unsigned char *ptr;         /**< The next position to write to */
+    unsigned char *end;         /**< The end of the reserved space */
+} mxbuf_writer_t;
+
+
+/**
+ * Reserve space in a buffer and start writing to it.
+ *
+ * @param[out] writer
+ *   The writer to initialise.
+ *
+ * @param[in] buffer
+ *   The buffer to write to.
+ *
+ * @param[in] size
+ *   The space to reserve. This is the maximum number of characters that
+ *   may be written before mxbuf_writer_end() is called.
+ */
+static inline void
+mxbuf_writer_begin(mxbuf_writer_t *writer, mxbuf_t *buffer, size_t size)
+{
+    mxbuf_require(buffer, size);
+
+    writer->buffer = buffer;
+    writer->ptr = buffer->available.ptr;
+    writer->end = &buffer->available.ptr[size];
+}
+
+
+/**
+ * Write a character using a writer.
+ */
+static inline void
+mxbuf_writer_putc(mxbuf_writer_t *writer, unsigned char c)
+{
+    assert(writer->ptr < writer->end);
+
+    *writer->ptr++ = c;
+}
+
+
+/**
+ * Write a string using a writer.
+ */
+static inline void
+mxbuf_writer_write(mxbuf_writer_t *writer, mxstr_t str)
+{
+    assert(str.len <= (size_t)(writer->end - writer->ptr));
+
+    memcpy(writer->ptr, str.ptr, str.len);
+    writer->ptr += str.len;
+}
+
+
+/**
+ * Finish writing, adding the characters written to the buffer contents.
+ */
+static inline void
+mxbuf_writer_end(mxbuf_writer_t *writer)
+{
+    mxbuf_commit(writer->buffer,
+                 writer->ptr - writer->buffer->available.ptr);
+}
+
+
 /**
  * Get a string reference for a buffers contents.
  *
@@ -758,4 +2625,31 @@ mxbuf_str(mxbuf_t *buffer)
 }
 
 
+/**
+ * Copy a string into memory allocated from an arena.
+ *
+ * @param[in] arena
+ *   The arena to allocate from.
+ *
+ * @param[in] str
+ *   The string to copy.
+ *
+ * @return
+ *   The copy of the string. The memory is released when the arena is reset
+ *   or freed.
+ */
+static inline mxstr_t
+mxstr_dup_arena(mxarena_t *arena, mxstr_t str)
+{
+    mxstr_t copy;
+
+    copy = mxstr(mxarena_alloc(arena, str.len), str.len);
+    if (str.len > 0) {
+        memcpy(copy.ptr, str.ptr, str.len);
+    }
+
+    return copy;
+}
+
+
 #endif
@@ -0,0 +1,648 @@
+/*
+ * ----------------------------------------------------------------------
+ * |\ /| mxstrmap.h
+ * | X | String Keyed Hash Map
+ * |/ \|
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef MXSTRMAP_H
+#define MXSTRMAP_H
+
+#include "mxarena.h"
+#include "mxhash.h"
+
+
+/*
+ * ----------------------------------------------------------------------
+ * Hash map
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * The map is an open addressing table in the style of Abseil's Swiss
+ * tables. Alongside the entries is an array of control bytes, one per
+ * slot: EMPTY, DELETED, or for a full slot the low 7 bits of the hash of
+ * its key (the tag). The slots are divided into groups of 16, and a lookup
+ * first selects a group from the remaining bits of the hash. The control
+ * bytes of the group are then compared with the tag in one go (a single
+ * SSE2 comparison, or two SWAR words), giving a bitmap of the candidate
+ * slots. Only 1 in 128 non-matching keys is a candidate, and the full hash
+ * is stored in each entry and compared before the key, so mxstr_cmp() is
+ * in practice only called for the key being looked up.
+ *
+ * If the key is not found in a group, and the group has no EMPTY slots,
+ * the next group in a triangular sequence is probed; with a power of 2
+ * number of groups this visits every group. A slot is only marked
+ * DELETED rather than EMPTY when its group has no EMPTY slots, as a probe
+ * may then have continued past it. The table is rebuilt when there are no
+ * EMPTY slots left within the maximum load of 7/8, at the same size if
+ * half or more of the used slots are DELETED, or at double the size.
+ */
+
+
+/**
+ * The number of slots in a group.
+ */
+#define MXSTRMAP_GROUP 16
+
+
+/**
+ * The control byte of an empty slot.
+ */
+#define MXSTRMAP_EMPTY 0x80
+
+
+/**
+ * The control byte of a slot whose entry was removed.
+ */
+#define MXSTRMAP_DELETED 0xfe
+
+
+/**
+ * Flags for mxstrmap_insert().
+ */
+enum {
+    MXSTRMAP_COPY = 1 << 0  /**< Copy new keys into the map's arena */
+};
+
+
+/**
+ * A map entry.
+ */
+typedef struct {
+    mxstr_t   key;      /**< The key */
+    uint64_t  hash;     /**< The hash of the key */
+    void     *value;    /**< The value */
+} mxstrmap_entry_t;
+
+
+/**
+ * A hash map with string keys.
+ *
+ * Keys are either borrowed, in which case the memory they refer to must
+ * remain valid while they are in the map, or copied into an arena owned by
+ * the map. Lookups take an mxstr_t, so keys need not be NUL terminated
+ * and lookups do not allocate memory:
+ *
+ *     mxstrmap_t        map;
+ *     mxstrmap_entry_t *entry;
+ *
+ *     mxstrmap_create(&map, 0);
+ *     if (mxstrmap_insert(&map, key, MXSTRMAP_COPY, &entry)) {
+ *         entry->value = ...;
+ *     }
+ *     ...
+ *     entry = mxstrmap_find(&map, name);
+ *     mxstrmap_free(&map);
+ *
+ * Entry pointers remain valid until the next insertion.
+ */
+typedef struct {
+    mxstrmap_entry_t *entries;      /**< The slots */
+    unsigned char    *ctrl;         /**< The control bytes of the slots */
+    size_t            capacity;     /**< The number of slots */
+    size_t            count;        /**< The number of entries */
+    size_t            growth_left;  /**< EMPTY slots usable before growing */
+    uint64_t          seed;         /**< The hash seed */
+    mxarena_t         arena;        /**< Memory for copied keys */
+} mxstrmap_t;
+
+
+/**
+ * Initialise a map.
+ *
+ * No memory is allocated until the first insertion.
+ *
+ * @param[in] map
+ *   The map to initialise. mxstrmap_free() must be called to free the
+ *   associated memory.
+ *
+ * @param[in] seed
+ *   The seed for mxstr_hash64_seed(). Where keys come from an untrusted
+ *   source a random seed makes collisions hard to construct.
+ */
+static inline void
+mxstrmap_create(mxstrmap_t *map, uint64_t seed)
+{
+    memset(map, 0, sizeof(*map));
+    map->seed = seed;
+    mxarena_create(&map->arena, 0);
+}
+
+
+/**
+ * Free the memory associated with a map, including copied keys.
+ */
+static inline void
+mxstrmap_free(mxstrmap_t *map)
+{
+    mxutil_free(map->entries);
+    mxarena_free(&map->arena);
+    map->entries = NULL;
+    map->ctrl = NULL;
+    map->capacity = 0;
+    map->count = 0;
+    map->growth_left = 0;
+}
+
+
+/**
+ * Remove all entries from a map.
+ *
+ * The table and the arena blocks are kept for reuse.
+ */
+static inline void
+mxstrmap_clear(mxstrmap_t *map)
+{
+    if (map->capacity > 0) {
+        memset(map->ctrl, MXSTRMAP_EMPTY, map->capacity);
+    }
+
+    mxarena_reset(&map->arena);
+    map->count = 0;
+    map->growth_left = map->capacity - map->capacity / 8;
+}
+
+
+/**
+ * Gather the high bit of each byte of a word into an 8 bit mask.
+ */
+static inline unsigned
+mxstrmap_swar_mask(uint64_t word)
+{
+    return (unsigned)((((word >> 7) & 0x0101010101010101ULL) *
+                       0x0102040810204080ULL) >> 56);
+}
+
+
+/**
+ * Find the slots of a group with a given control byte (scalar kernel).
+ *
+ * @return
+ *   A bitmap of the matching slots.
+ */
+static inline unsigned
+mxstrmap_match_scalar(const unsigned char *ctrl, unsigned char c)
+{
+    const uint64_t pattern = c * 0x0101010101010101ULL;
+
+    return mxstrmap_swar_mask(
+               mxutil_swar_zero(mxutil_load_u64le(ctrl) ^ pattern)) |
+           (mxstrmap_swar_mask(
+               mxutil_swar_zero(mxutil_load_u64le(ctrl + 8) ^ pattern)) << 8);
+}
+
+
+/**
+ * Find the EMPTY and DELETED slots of a group (scalar kernel).
+ *
+ * @return
+ *   A bitmap of the slots.
+ */
+static inline unsigned
+mxstrmap_match_free_scalar(const unsigned char *ctrl)
+{
+    return mxstrmap_swar_mask(mxutil_load_u64le(ctrl)) |
+           (mxstrmap_swar_mask(mxutil_load_u64le(ctrl + 8)) << 8);
+}
+
+
+#ifdef MXUTIL_SIMD_X86
+
+/**
+ * Find the slots of a group with a given control byte (SSE2 kernel).
+ *
+ * @return
+ *   A bitmap of the matching slots.
+ */
+static inline unsigned
+mxstrmap_match_sse2(const unsigned char *ctrl, unsigned char c)
+{
+    return _mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)ctrl),
+                       _mm_set1_epi8((char)c)));
+}
+
+
+/**
+ * Find the EMPTY and DELETED slots of a group (SSE2 kernel).
+ *
+ * @return
+ *   A bitmap of the slots.
+ */
+static inline unsigned
+mxstrmap_match_free_sse2(const unsigned char *ctrl)
+{
+    return _mm_movemask_epi8(_mm_loadu_si128((__m128i *)ctrl));
+}
+
+#endif
+
+
+/**
+ * Find the slots of a group with a given control byte.
+ *
+ * @param[in] ctrl
+ *   The control bytes of the group.
+ *
+ * @param[in] c
+ *   The control byte to find: a tag or MXSTRMAP_EMPTY.
+ *
+ * @return
+ *   A bitmap of the matching slots.
+ */
+static inline unsigned
+mxstrmap_match(const unsigned char *ctrl, unsigned char c)
+{
+#ifdef MXUTIL_SIMD_X86
+    return mxstrmap_match_sse2(ctrl, c);
+#else
+    return mxstrmap_match_scalar(ctrl, c);
+#endif
+}
+
+
+/**
+ * Find the EMPTY and DELETED slots of a group.
+ *
+ * Both have the high bit set, which full slots do not.
+ *
+ * @param[in] ctrl
+ *   The control bytes of the group.
+ *
+ * @return
+ *   A bitmap of the slots.
+ */
+static inline unsigned
+mxstrmap_match_free(const unsigned char *ctrl)
+{
+#ifdef MXUTIL_SIMD_X86
+    return mxstrmap_match_free_sse2(ctrl);
+#else
+    return mxstrmap_match_free_scalar(ctrl);
+#endif
+}
+
+
+/**
+ * Find a slot for a key in a map, or the slot it would be inserted into.
+ *
+ * @param[in] map
+ *   The map. The capacity must be non-zero.
+ *
+ * @param[in] key
+ *   The key.
+ *
+ * @param[in] hash
+ *   The hash of the key.
+ *
+ * @param[out] slot
+ *   The slot containing the key if found, otherwise the first EMPTY or
+ *   DELETED slot in the probe sequence.
+ *
+ * @return
+ *   Indicates whether the key was found.
+ */
+static inline bool
+mxstrmap_probe(const mxstrmap_t *map, mxstr_t key, uint64_t hash,
+               size_t *slot)
+{
+    const unsigned char     tag = hash & 0x7f;
+    const size_t            mask = map->capacity / MXSTRMAP_GROUP - 1;
+    const unsigned char    *ctrl;
+    const mxstrmap_entry_t *entry;
+    size_t                  group = (hash >> 7) & mask;
+    size_t                  step = 0;
+    size_t                  idx;
+    unsigned                bits;
+    bool                    found_free = false;
+
+    for (;;) {
+        ctrl = &map->ctrl[group * MXSTRMAP_GROUP];
+
+        for (bits = mxstrmap_match(ctrl, tag); bits != 0; bits &= bits - 1) {
+            idx = group * MXSTRMAP_GROUP + __builtin_ctz(bits);
+            entry = &map->entries[idx];
+            if (entry->hash == hash && entry->key.len == key.len &&
+                mxstr_cmp(entry->key, key) == 0) {
+                *slot = idx;
+                return true;
+            }
+        }
+
+        if (!found_free) {
+            bits = mxstrmap_match_free(ctrl);
+            if (bits != 0) {
+                *slot = group * MXSTRMAP_GROUP + __builtin_ctz(bits);
+                found_free = true;
+            }
+        }
+
+        if (mxstrmap_match(ctrl, MXSTRMAP_EMPTY) != 0) {
+            return false;
+        }
+
+        group = (group + ++step) & mask;
+    }
+}
+
+
+/**
+ * Find the first EMPTY slot for a hash in a table with no DELETED slots.
+ */
+static inline size_t
+mxstrmap_probe_empty(const mxstrmap_t *map, uint64_t hash)
+{
+    const size_t mask = map->capacity / MXSTRMAP_GROUP - 1;
+    size_t       group = (hash >> 7) & mask;
+    size_t       step = 0;
+    unsigned     bits;
+
+    while ((bits = mxstrmap_match_free(
+                &map->ctrl[group * MXSTRMAP_GROUP])) == 0) {
+        group = (group + ++step) & mask;
+    }
+
+    return group * MXSTRMAP_GROUP + __builtin_ctz(bits);
+}
+
+
+/**
+ * Rebuild the table of a map with a new capacity, dropping DELETED slots.
+ *
+ * @param[in] map
+ *   The map.
+ *
+ * @param[in] capacity
+ *   The new capacity, a power of 2 of at least MXSTRMAP_GROUP with room
+ *   for the existing entries.
+ */
+static inline void
+mxstrmap_rehash(mxstrmap_t *map, size_t capacity)
+{
+    mxstrmap_entry_t *entries = map->entries;
+    unsigned char    *ctrl = map->ctrl;
+    size_t            old_capacity = map->capacity;
+    size_t            idx, slot;
+
+    map->entries = mxutil_malloc(capacity * (sizeof(mxstrmap_entry_t) + 1));
+    map->ctrl = (unsigned char *)&map->entries[capacity];
+    map->capacity = capacity;
+    memset(map->ctrl, MXSTRMAP_EMPTY, capacity);
+
+    /* The stored hashes avoid hashing the keys again. */
+    for (idx = 0; idx < old_capacity; idx++) {
+        if (ctrl[idx] < MXSTRMAP_EMPTY) {
+            slot = mxstrmap_probe_empty(map, entries[idx].hash);
+            map->ctrl[slot] = ctrl[idx];
+            map->entries[slot] = entries[idx];
+        }
+    }
+
+    map->growth_left = capacity - capacity / 8 - map->count;
+    mxutil_free(entries);
+}
+
+
+/**
+ * Find the entry for a key.
+ *
+ * @param[in] map
+ *   The map.
+ *
+ * @param[in] key
+ *   The key to find.
+ *
+ * @return
+ *   The entry, or NULL if the key is not in the map.
+ */
+static inline mxstrmap_entry_t *
+mxstrmap_find(const mxstrmap_t *map, mxstr_t key)
+{
+    size_t slot;
+
+    if (map->count == 0 ||
+        !mxstrmap_probe(map, key, mxstr_hash64_seed(key, map->seed),
+                        &slot)) {
+        return NULL;
+    }
+
+    return &map->entries[slot];
+}
+
+
+/**
+ * Get the value for a key.
+ *
+ * @param[in] map
+ *   The map.
+ *
+ * @param[in] key
+ *   The key to find.
+ *
+ * @param[out] value
+ *   The value. Not set if the key is not in the map.
+ *
+ * @return
+ *   Indicates whether the key is in the map.
+ */
+static inline bool
+mxstrmap_get(const mxstrmap_t *map, mxstr_t key, void **value)
+{
+    mxstrmap_entry_t *entry = mxstrmap_find(map, key);
+
+    if (entry == NULL) {
+        return false;
+    }
+
+    *value = entry->value;
+
+    return true;
+}
+
+
+/**
+ * Find or add the entry for a key.
+ *
+ * @param[in] map
+ *   The map.
+ *
+ * @param[in] key
+ *   The key.
+ *
+ * @param[in] flags
+ *   MXSTRMAP_COPY to copy the key into the map's arena if it is added.
+ *   Otherwise the key is borrowed, and its memory must remain valid while
+ *   it is in the map.
+ *
+ * @param[out] entry
+ *   The existing entry for the key, or the new entry with a NULL value.
+ *   NULL may be passed.
+ *
+ * @return
+ *   Indicates whether the key was added.
+ */
+static inline bool
+mxstrmap_insert(mxstrmap_t *map, mxstr_t key, unsigned flags,
+                mxstrmap_entry_t **entry)
+{
+    uint64_t          hash = mxstr_hash64_seed(key, map->seed);
+    mxstrmap_entry_t *new_entry;
+    size_t            slot = 0;
+
+    if (map->capacity == 0) {
+        mxstrmap_rehash(map, MXSTRMAP_GROUP);
+    }
+
+    if (mxstrmap_probe(map, key, hash, &slot)) {
+        if (entry != NULL) {
+            *entry = &map->entries[slot];
+        }
+        return false;
+    }
+
+    if (map->ctrl[slot] == MXSTRMAP_EMPTY) {
+        if (map->growth_left == 0) {
+            if (map->count < (map->capacity - map->capacity / 8) / 2) {
+                mxstrmap_rehash(map, map->capacity);
+            } else {
+                mxstrmap_rehash(map, map->capacity * 2);
+            }
+            slot = mxstrmap_probe_empty(map, hash);
+        }
+        map->growth_left--;
+    }
+
+    if ((flags & MXSTRMAP_COPY) && key.len > 0) {
+        key.ptr = memcpy(mxarena_alloc(&map->arena, key.len), key.ptr,
+                         key.len);
+    }
+
+    map->ctrl[slot] = hash & 0x7f;
+    new_entry = &map->entries[slot];
+    new_entry->key = key;
+    new_entry->hash = hash;
+    new_entry->value = NULL;
+    map->count++;
+
+    if (entry != NULL) {
+        *entry = new_entry;
+    }
+
+    return true;
+}
+
+
+/**
+ * Set the value for a key, adding the key if it is not in the map.
+ *
+ * @param[in] map
+ *   The map.
+ *
+ * @param[in] key
+ *   The key.
+ *
+ * @param[in] value
+ *   The value.
+ *
+ * @param[in] flags
+ *   See mxstrmap_insert().
+ */
+static inline void
+mxstrmap_set(mxstrmap_t *map, mxstr_t key, void *value, unsigned flags)
+{
+    mxstrmap_entry_t *entry;
+
+    (void)mxstrmap_insert(map, key, flags, &entry);
+    entry->value = value;
+}
+
+
+/**
+ * Remove a key from a map.
+ *
+ * The memory of a copied key is not reclaimed until the map is cleared or
+ * freed.
+ *
+ * @param[in] map
+ *   The map.
+ *
+ * @param[in] key
+ *   The key to remove.
+ *
+ * @return
+ *   Indicates whether the key was in the map.
+ */
+static inline bool
+mxstrmap_remove(mxstrmap_t *map, mxstr_t key)
+{
+    unsigned char *ctrl;
+    size_t         slot;
+
+    if (map->count == 0 ||
+        !mxstrmap_probe(map, key, mxstr_hash64_seed(key, map->seed),
+                        &slot)) {
+        return false;
+    }
+
+    ctrl = &map->ctrl[slot & ~(size_t)(MXSTRMAP_GROUP - 1)];
+    if (mxstrmap_match(ctrl, MXSTRMAP_EMPTY) != 0) {
+        map->ctrl[slot] = MXSTRMAP_EMPTY;
+        map->growth_left++;
+    } else {
+        map->ctrl[slot] = MXSTRMAP_DELETED;
+    }
+
+    map->count--;
+
+    return true;
+}
+
+
+/**
+ * Iterate over the entries of a map.
+ *
+ * The entries are returned in no particular order:
+ *
+ *     size_t            pos = 0;
+ *     mxstrmap_entry_t *entry;
+ *
+ *     while (mxstrmap_next(&map, &pos, &entry)) {
+ *         ...
+ *     }
+ *
+ * The map must not be modified during the iteration, except by changing
+ * entry values.
+ *
+ * @param[in] map
+ *   The map.
+ *
+ * @param[in,out] pos
+ *   The iteration position, initially 0.
+ *
+ * @param[out] entry
+ *   The next entry. Not set at the end of the iteration.
+ *
+ * @return
+ *   Indicates whether an entry was returned.
+ */
+static inline bool
+mxstrmap_next(const mxstrmap_t *map, size_t *pos, mxstrmap_entry_t **entry)
+{
+    size_t idx;
+
+    for (idx = *pos; idx < map->capacity; idx++) {
+        if (map->ctrl[idx] < MXSTRMAP_EMPTY) {
+            *entry = &map->entries[idx];
+            *pos = idx + 1;
+            return true;
+        }
+    }
+
+    *pos = idx;
+
+    return false;
+}
+
+#endif
@@ -0,0 +1,1181 @@
+/*
+ * ----------------------------------------------------------------------
+ * |\ /| mxutf8.h
+ * | X | Unicode API
+ * |/ \|
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef MXUTF8_H
+#define MXUTF8_H
+
+#include "mxstr.h"
+
+
+/*
+ * ----------------------------------------------------------------------
+ * Validation
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * UTF-8 is validated using the lookup algorithm of Keiser and Lemire
+ * ("Validating UTF-8 In Less Than One Instruction Per Byte", 2021).
+ * Each byte is classified together with the byte before it using three
+ * 16 entry tables (indexed by the high and low nibbles of the previous
+ * byte and the high nibble of the current byte). The AND of the three
+ * lookups is non-zero for any invalid two byte combination, and the
+ * remaining cases (3rd and 4th bytes of a sequence) are checked against
+ * the bytes 2 and 3 positions earlier.
+ *
+ * The vector kernels only detect which block contains the first error.
+ * The exact position is then found by the scalar implementation, starting
+ * from the last character boundary before the block.
+ */
+
+#define MXUTF8_TOO_SHORT   (1 << 0)
+#define MXUTF8_TOO_LONG    (1 << 1)
+#define MXUTF8_OVERLONG_3  (1 << 2)
+#define MXUTF8_TOO_LARGE   (1 << 3)
+#define MXUTF8_SURROGATE   (1 << 4)
+#define MXUTF8_OVERLONG_2  (1 << 5)
+#define MXUTF8_TOO_LARGE_1000 (1 << 6)
+#define MXUTF8_OVERLONG_4  (1 << 6)
+#define MXUTF8_TWO_CONTS   (-0x80) /* 1 << 7, as a signed char */
+#define MXUTF8_CARRY       (MXUTF8_TOO_SHORT | MXUTF8_TOO_LONG |         \
+                            MXUTF8_TWO_CONTS)
+
+
+/**
+ * Table indexed by the high nibble of the previous byte.
+ */
+#define MXUTF8_BYTE_1_HIGH                                              \
+    MXUTF8_TOO_LONG, MXUTF8_TOO_LONG, MXUTF8_TOO_LONG, MXUTF8_TOO_LONG, \
+    MXUTF8_TOO_LONG, MXUTF8_TOO_LONG, MXUTF8_TOO_LONG, MXUTF8_TOO_LONG, \
+    MXUTF8_TWO_CONTS, MXUTF8_TWO_CONTS, MXUTF8_TWO_CONTS,               \
+    MXUTF8_TWO_CONTS,                                                   \
+    MXUTF8_TOO_SHORT | MXUTF8_OVERLONG_2,                               \
+    MXUTF8_TOO_SHORT,                                                   \
+    MXUTF8_TOO_SHORT | MXUTF8_OVERLONG_3 | MXUTF8_SURROGATE,            \
+    MXUTF8_TOO_SHORT | MXUTF8_TOO_LARGE | MXUTF8_TOO_LARGE_1000 |       \
+        MXUTF8_OVERLONG_4
+
+
+/**
+ * Table indexed by the low nibble of the previous byte.
+ */
+#define MXUTF8_BYTE_1_LOW                                               \
+    MXUTF8_CARRY | MXUTF8_OVERLONG_3 | MXUTF8_OVERLONG_2 |              \
+        MXUTF8_OVERLONG_4,                                              \
+    MXUTF8_CARRY | MXUTF8_OVERLONG_2,                                   \
+    MXUTF8_CARRY,                                                       \
+    MXUTF8_CARRY,                                                       \
+    MXUTF8_CARRY | MXUTF8_TOO_LARGE,                                    \
+    MXUTF8_CARRY | MXUTF8_TOO_LARGE | MXUTF8_TOO_LARGE_1000,            \
+    MXUTF8_CARRY | MXUTF8_TOO_LARGE | MXUTF8_TOO_LARGE_1000,            \
+    MXUTF8_CARRY | MXUTF8_TOO_LARGE | MXUTF8_TOO_LARGE_1000,            \
+    MXUTF8_CARRY | MXUTF8_TOO_LARGE | MXUTF8_TOO_LARGE_1000,            \
+    MXUTF8_CARRY | MXUTF8_TOO_LARGE | MXUTF8_TOO_LARGE_1000,            \
+    MXUTF8_CARRY | MXUTF8_TOO_LARGE | MXUTF8_TOO_LARGE_1000,            \
+    MXUTF8_CARRY | MXUTF8_TOO_LARGE | MXUTF8_TOO_LARGE_1000,            \
+    MXUTF8_CARRY | MXUTF8_TOO_LARGE | MXUTF8_TOO_LARGE_1000,            \
+    MXUTF8_CARRY | MXUTF8_TOO_LARGE | MXUTF8_TOO_LARGE_1000 |           \
+        MXUTF8_SURROGATE,                                               \
+    MXUTF8_CARRY | MXUTF8_TOO_LARGE | MXUTF8_TOO_LARGE_1000,            \
+    MXUTF8_CARRY | MXUTF8_TOO_LARGE | MXUTF8_TOO_LARGE_1000
+
+
+/**
+ * Table indexed by the high nibble of the current byte.
+ */
+#define MXUTF8_BYTE_2_HIGH                                              \
+    MXUTF8_TOO_SHORT, MXUTF8_TOO_SHORT, MXUTF8_TOO_SHORT,               \
+    MXUTF8_TOO_SHORT, MXUTF8_TOO_SHORT, MXUTF8_TOO_SHORT,               \
+    MXUTF8_TOO_SHORT, MXUTF8_TOO_SHORT,                                 \
+    MXUTF8_TOO_LONG | MXUTF8_OVERLONG_2 | MXUTF8_TWO_CONTS |            \
+        MXUTF8_OVERLONG_3 | MXUTF8_TOO_LARGE_1000 | MXUTF8_OVERLONG_4,  \
+    MXUTF8_TOO_LONG | MXUTF8_OVERLONG_2 | MXUTF8_TWO_CONTS |            \
+        MXUTF8_OVERLONG_3 | MXUTF8_TOO_LARGE,                           \
+    MXUTF8_TOO_LONG | MXUTF8_OVERLONG_2 | MXUTF8_TWO_CONTS |            \
+        MXUTF8_SURROGATE | MXUTF8_TOO_LARGE,                            \
+    MXUTF8_TOO_LONG | MXUTF8_OVERLONG_2 | MXUTF8_TWO_CONTS |            \
+        MXUTF8_SURROGATE | MXUTF8_TOO_LARGE,                            \
+    MXUTF8_TOO_SHORT, MXUTF8_TOO_SHORT, MXUTF8_TOO_SHORT,               \
+    MXUTF8_TOO_SHORT
+
+
+/**
+ * Decode a UTF-8 sequence.
+ *
+ * @param[in] ptr
+ *   The start of the sequence.
+ *
+ * @param[in] avail
+ *   The number of characters available. This must be at least 1.
+ *
+ * @param[out] c
+ *   The decoded codepoint.
+ *
+ * @return
+ *   The length of the sequence, or 0 if the sequence is invalid or
+ *   truncated.
+ */
+static inline size_t
+mxstr_utf8_decode(const unsigned char *ptr, size_t avail, uint32_t *c)
+{
+    uint32_t cp;
+
+    /* Each form is decoded first and then checked, which avoids a branch
+     * per continuation byte. Overlong encodings, surrogates and codepoints
+     * above 0x10ffff are rejected by range checks on the result. */
+    if (ptr[0] < 0x80) {
+        *c = ptr[0];
+        return 1;
+    }
+
+    if (ptr[0] < 0xe0) {
+        if (ptr[0] < 0xc2 || avail < 2 || (ptr[1] & 0xc0) != 0x80) {
+            return 0;
+        }
+
+        *c = ((uint32_t)(ptr[0] & 0x1f) << 6) | (ptr[1] & 0x3f);
+        return 2;
+    }
+
+    if (ptr[0] < 0xf0) {
+        if (avail < 3 || (((ptr[1] ^ 0x80) | (ptr[2] ^ 0x80)) & 0xc0) != 0) {
+            return 0;
+        }
+
+        cp = ((uint32_t)(ptr[0] & 0x0f) << 12) |
+            ((uint32_t)(ptr[1] & 0x3f) << 6) | (ptr[2] & 0x3f);
+        if (cp < 0x800 || (cp >= 0xd800 && cp <= 0xdfff)) {
+            return 0;
+        }
+
+        *c = cp;
+        return 3;
+    }
+
+    if (avail < 4 ||
+        (((ptr[1] ^ 0x80) | (ptr[2] ^ 0x80) | (ptr[3] ^ 0x80)) & 0xc0) != 0) {
+        return 0;
+    }
+
+    cp = ((uint32_t)(ptr[0] & 0x07) << 18) |
+        ((uint32_t)(ptr[1] & 0x3f) << 12) |
+        ((uint32_t)(ptr[2] & 0x3f) << 6) | (ptr[3] & 0x3f);
+    if (ptr[0] > 0xf4 || cp < 0x10000 || cp > 0x10ffff) {
+        return 0;
+    }
+
+    *c = cp;
+    return 4;
+}
+
+
+/**
+ * Find the first UTF-8 error (scalar implementation).
+ *
+ * @param[in] str
+ *   The string to validate.
+ *
+ * @param[in] idx
+ *   The offset to start validating from. This must be a character
+ *   boundary.
+ *
+ * @return
+ *   The offset of the first invalid sequence, or str.len if the string is
+ *   valid.
+ */
+static inline size_t
+mxstr_utf8_validate_scalar(mxstr_t str, size_t idx)
+{
+    const unsigned char *ptr = str.ptr;
+    uint32_t             c;
+    size_t               len;
+
+    while (idx < str.len) {
+        /* Skip ASCII 8 bytes at a time. */
+        if (idx + 8 <= str.len &&
+            (mxutil_load_u64le(&ptr[idx]) & 0x8080808080808080ULL) == 0) {
+            idx += 8;
+            continue;
+        }
+
+        len = mxstr_utf8_decode(&ptr[idx], str.len - idx, &c);
+        if (len == 0) {
+            return idx;
+        }
+
+        idx += len;
+    }
+
+    return str.len;
+}
+
+
+/**
+ * Find the character boundary to resume scalar validation from.
+ *
+ * The input before idx is known to be valid, except that it may end with
+ * an incomplete sequence.
+ */
+static inline size_t
+mxstr_utf8_boundary(mxstr_t str, size_t idx)
+{
+    size_t pos;
+
+    /* Errors in a lead byte in the last 3 bytes may not be detected until
+     * the following bytes are checked, so resume from the lead byte. */
+    for (pos = idx; pos > 0 && pos + 3 > idx; pos--) {
+        if ((str.ptr[pos - 1] & 0xc0) != 0x80) {
+            return (str.ptr[pos - 1] >= 0xc0) ? pos - 1 : idx;
+        }
+    }
+
+    return idx;
+}
+
+
+#ifdef MXUTIL_SIMD_X86
+
+/**
+ * Find the block containing the first UTF-8 error (SSSE3 kernel).
+ *
+ * @return
+ *   The offset to resume scalar validation from: the start of the block
+ *   containing the first error, or the start of the unprocessed tail.
+ */
+MXUTIL_TARGET("ssse3") static inline size_t
+mxstr_utf8_validate_ssse3(mxstr_t str)
+{
+    const __m128i byte_1_high = _mm_setr_epi8(MXUTF8_BYTE_1_HIGH);
+    const __m128i byte_1_low = _mm_setr_epi8(MXUTF8_BYTE_1_LOW);
+    const __m128i byte_2_high = _mm_setr_epi8(MXUTF8_BYTE_2_HIGH);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i max_incomplete = _mm_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+    __m128i       prev = _mm_setzero_si128();
+    __m128i       incomplete = _mm_setzero_si128();
+    __m128i       in, prev1, prev2, prev3, sc, must23;
+    size_t        idx;
+
+    for (idx = 0; idx + 16 <= str.len; idx += 16) {
+        in = _mm_loadu_si128((__m128i *)&str.ptr[idx]);
+
+        if (_mm_movemask_epi8(in) == 0) {
+            /* ASCII: only check the previous block was complete. */
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(
+                    incomplete, _mm_setzero_si128())) != 0xffff) {
+                return idx;
+            }
+        } else {
+            prev1 = _mm_alignr_epi8(in, prev, 15);
+            prev2 = _mm_alignr_epi8(in, prev, 14);
+            prev3 = _mm_alignr_epi8(in, prev, 13);
+
+            sc = _mm_and_si128(_mm_and_si128(
+                _mm_shuffle_epi8(byte_1_high,
+                    _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+                _mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, nibble))),
+                _mm_shuffle_epi8(byte_2_high,
+                    _mm_and_si128(_mm_srli_epi16(in, 4), nibble)));
+
+            must23 = _mm_and_si128(_mm_or_si128(
+                _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xe0 - 0x80))),
+                _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xf0 - 0x80)))),
+                _mm_set1_epi8((char)0x80));
+
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(
+                    _mm_xor_si128(must23, sc), _mm_setzero_si128())) !=
+                0xffff) {
+                return idx;
+            }
+        }
+
+        incomplete = _mm_subs_epu8(in, max_incomplete);
+        prev = in;
+    }
+
+    return idx;
+}
+
+
+/**
+ * Shift a 32 byte vector right by N bytes, shifting in the last bytes of
+ * the previous vector.
+ */
+#define MXUTF8_PREV_AVX2(in_, prev_, n_)                                \
+    _mm256_alignr_epi8((in_),                                           \
+                       _mm256_permute2x128_si256((prev_), (in_), 0x21), \
+                       16 - (n_))
+
+
+/**
+ * Find the block containing the first UTF-8 error (AVX2 kernel).
+ *
+ * @return
+ *   See mxstr_utf8_validate_ssse3().
+ */
+MXUTIL_TARGET("avx2") static inline size_t
+mxstr_utf8_validate_avx2(mxstr_t str)
+{
+    const __m256i byte_1_high = _mm256_setr_epi8(MXUTF8_BYTE_1_HIGH,
+                                                 MXUTF8_BYTE_1_HIGH);
+    const __m256i byte_1_low = _mm256_setr_epi8(MXUTF8_BYTE_1_LOW,
+                                                MXUTF8_BYTE_1_LOW);
+    const __m256i byte_2_high = _mm256_setr_epi8(MXUTF8_BYTE_2_HIGH,
+                                                 MXUTF8_BYTE_2_HIGH);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i max_incomplete = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+    __m256i       prev = _mm256_setzero_si256();
+    __m256i       incomplete = _mm256_setzero_si256();
+    __m256i       in, prev1, prev2, prev3, sc, must23;
+    size_t        idx;
+
+    for (idx = 0; idx + 32 <= str.len; idx += 32) {
+        in = _mm256_loadu_si256((__m256i *)&str.ptr[idx]);
+
+        if (_mm256_movemask_epi8(in) == 0) {
+            if (!_mm256_testz_si256(incomplete, incomplete)) {
+                return idx;
+            }
+        } else {
+            prev1 = MXUTF8_PREV_AVX2(in, prev, 1);
+            prev2 = MXUTF8_PREV_AVX2(in, prev, 2);
+            prev3 = MXUTF8_PREV_AVX2(in, prev, 3);
+
+            sc = _mm256_and_si256(_mm256_and_si256(
+                _mm256_shuffle_epi8(byte_1_high,
+                    _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+                _mm256_shuffle_epi8(byte_1_low,
+                    _mm256_and_si256(prev1, nibble))),
+                _mm256_shuffle_epi8(byte_2_high,
+                    _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble)));
+
+            must23 = _mm256_and_si256(_mm256_or_si256(
+                _mm256_subs_epu8(prev2,
+                                 _mm256_set1_epi8((char)(0xe0 - 0x80))),
+                _mm256_subs_epu8(prev3,
+                                 _mm256_set1_epi8((char)(0xf0 - 0x80)))),
+                _mm256_set1_epi8((char)0x80));
+
+            sc = _mm256_xor_si256(must23, sc);
+            if (!_mm256_testz_si256(sc, sc)) {
+                return idx;
+            }
+        }
+
+        incomplete = _mm256_subs_epu8(in, max_incomplete);
+        prev = in;
+    }
+
+    return idx;
+}
+
+
+/**
+ * Shift a 64 byte vector right by N bytes, shifting in the last bytes of
+ * the previous vector.
+ */
+#define MXUTF8_PREV_AVX512(in_, prev_, n_)                              \
+    _mm512_alignr_epi8((in_), _mm512_alignr_epi64((in_), (prev_), 6),   \
+                       16 - (n_))
+
+
+/**
+ * Find the block containing the first UTF-8 error (AVX-512 kernel).
+ *
+ * @return
+ *   See mxstr_utf8_validate_ssse3().
+ */
+MXUTIL_TARGET("avx512f,avx512bw") static inline size_t
+mxstr_utf8_validate_avx512(mxstr_t str)
+{
+    const __m512i byte_1_high = _mm512_broadcast_i32x4(
+        _mm_setr_epi8(MXUTF8_BYTE_1_HIGH));
+    const __m512i byte_1_low = _mm512_broadcast_i32x4(
+        _mm_setr_epi8(MXUTF8_BYTE_1_LOW));
+    const __m512i byte_2_high = _mm512_broadcast_i32x4(
+        _mm_setr_epi8(MXUTF8_BYTE_2_HIGH));
+    const __m512i nibble = _mm512_set1_epi8(0x0f);
+    const __m512i max_incomplete = _mm512_inserti32x4(
+        _mm512_set1_epi8(-1),
+        _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                      (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1)),
+        3);
+    __m512i       prev = _mm512_setzero_si512();
+    __m512i       incomplete = _mm512_setzero_si512();
+    __m512i       in, prev1, prev2, prev3, sc, must23;
+    size_t        idx;
+
+    for (idx = 0; idx + 64 <= str.len; idx += 64) {
+        in = _mm512_loadu_si512(&str.ptr[idx]);
+
+        if (_mm512_movepi8_mask(in) == 0) {
+            if (_mm512_test_epi8_mask(incomplete, incomplete) != 0) {
+                return idx;
+            }
+        } else {
+            prev1 = MXUTF8_PREV_AVX512(in, prev, 1);
+            prev2 = MXUTF8_PREV_AVX512(in, prev, 2);
+            prev3 = MXUTF8_PREV_AVX512(in, prev, 3);
+
+            sc = _mm512_and_si512(_mm512_and_si512(
+                _mm512_shuffle_epi8(byte_1_high,
+                    _mm512_and_si512(_mm512_srli_epi16(prev1, 4), nibble)),
+                _mm512_shuffle_epi8(byte_1_low,
+                    _mm512_and_si512(prev1, nibble))),
+                _mm512_shuffle_epi8(byte_2_high,
+                    _mm512_and_si512(_mm512_srli_epi16(in, 4), nibble)));
+
+            must23 = _mm512_and_si512(_mm512_or_si512(
+                _mm512_subs_epu8(prev2,
+                                 _mm512_set1_epi8((char)(0xe0 - 0x80))),
+                _mm512_subs_epu8(prev3,
+                                 _mm512_set1_epi8((char)(0xf0 - 0x80)))),
+                _mm512_set1_epi8((char)0x80));
+
+            sc = _mm512_xor_si512(must23, sc);
+            if (_mm512_test_epi8_mask(sc, sc) != 0) {
+                return idx;
+            }
+        }
+
+        incomplete = _mm512_subs_epu8(in, max_incomplete);
+        prev = in;
+    }
+
+    return idx;
+}
+
+#endif
+
+
+/**
+ * Validate a UTF-8 string.
+ *
+ * Overlong encodings, surrogates (U+D800..U+DFFF), codepoints above
+ * U+10FFFF, unexpected continuation bytes and truncated sequences are all
+ * rejected.
+ *
+ * @param[in] str
+ *   The string to validate.
+ *
+ * @param[out] error
+ *   The offset of the first invalid sequence, i.e. the length of the
+ *   longest prefix of the string that is valid UTF-8. Not set when the
+ *   string is valid. NULL may be passed.
+ *
+ * @return
+ *   Indicates whether the string is valid UTF-8.
+ */
+static inline bool
+mxstr_utf8_validate(mxstr_t str, size_t *error)
+{
+    size_t idx = 0;
+
+#ifdef MXUTIL_SIMD_X86
+    if (str.len >= 64 && mxutil_cpu_avx512bw()) {
+        idx = mxstr_utf8_validate_avx512(str);
+    } else if (str.len >= 32 && mxutil_cpu_avx2()) {
+        idx = mxstr_utf8_validate_avx2(str);
+    } else if (str.len >= 16 && mxutil_cpu_ssse3()) {
+        idx = mxstr_utf8_validate_ssse3(str);
+    }
+#endif
+
+    idx = mxstr_utf8_validate_scalar(str, mxstr_utf8_boundary(str, idx));
+
+    if (idx < str.len && error != NULL) {
+        *error = idx;
+    }
+
+    return (idx == str.len);
+}
+
+
+/*
+ * ----------------------------------------------------------------------
+ * Decoding
+ * ----------------------------------------------------------------------
+ */
+
+
+/**
+ * Get the first unicode codepoint from a UTF-8 string.
+ *
+ * This is the UTF-8 equivalent of mxstr_getchar(). The length of the
+ * sequence that was decoded is mxstr_utf8_len(*c).
+ *
+ * @param[in] str
+ *   The string.
+ *
+ * @param[out] c
+ *   The codepoint.
+ *
+ * @return
+ *   Indicates whether a valid codepoint was present. false is returned if
+ *   the string is empty, or starts with an invalid or truncated sequence.
+ */
+static inline bool
+mxstr_get_utf8(mxstr_t str, uint32_t *c)
+{
+    return (str.len > 0 && mxstr_utf8_decode(str.ptr, str.len, c) > 0);
+}
+
+
+/**
+ * Consume a unicode codepoint from the start of a UTF-8 string.
+ *
+ * For example, to iterate over the codepoints of a string:
+ *
+ *     while (mxstr_consume_utf8(&str, &c)) {
+ *         ...
+ *     }
+ *
+ *     if (!mxstr_empty(str)) {
+ *         // Invalid UTF-8
+ *     }
+ *
+ * @param[in,out] str
+ *   The string. If a valid codepoint is present, it is removed from the
+ *   start of the string.
+ *
+ * @param[out] c
+ *   The codepoint.
+ *
+ * @return
+ *   Indicates whether a valid codepoint was consumed.
+ */
+static inline bool
+mxstr_consume_utf8(mxstr_t *str, uint32_t *c)
+{
+    size_t len = 0;
+
+    if (str->len > 0) {
+        len = mxstr_utf8_decode(str->ptr, str->len, c);
+        (void)mxstr_consume(str, len);
+    }
+
+    return (len > 0);
+}
+
+
+/**
+ * Convert a run of ASCII characters to UTF-32 (scalar kernel).
+ *
+ * Characters are converted in blocks of 8, stopping at the first block
+ * containing a non-ASCII character.
+ *
+ * @return
+ *   The number of characters converted.
+ */
+static inline size_t
+mxstr_ascii_to_utf32_scalar(mxstr_t str, uint32_t *dest)
+{
+    size_t idx;
+    size_t pos;
+
+    for (idx = 0; idx + 8 <= str.len; idx += 8) {
+        if ((mxutil_load_u64le(&str.ptr[idx]) & 0x8080808080808080ULL) != 0) {
+            break;
+        }
+
+        for (pos = idx; pos < idx + 8; pos++) {
+            dest[pos] = str.ptr[pos];
+        }
+    }
+
+    return idx;
+}
+
+
+#ifdef MXUTIL_SIMD_X86
+
+/**
+ * Convert a run of ASCII characters to UTF-32 (AVX2 kernel).
+ *
+ * Characters are converted in blocks of 32, stopping at the first block
+ * containing a non-ASCII character.
+ *
+ * @return
+ *   The number of characters converted.
+ */
+MXUTIL_TARGET("avx2") static inline size_t
+mxstr_ascii_to_utf32_avx2(mxstr_t str, uint32_t *dest)
+{
+    __m256i in;
+    __m128i lo;
+    __m128i hi;
+    size_t  idx;
+
+    for (idx = 0; idx + 32 <= str.len; idx += 32) {
+        in = _mm256_loadu_si256((__m256i *)&str.ptr[idx]);
+        if (_mm256_movemask_epi8(in) != 0) {
+            break;
+        }
+
+        lo = _mm256_castsi256_si128(in);
+        hi = _mm256_extracti128_si256(in, 1);
+
+        _mm256_storeu_si256((__m256i *)&dest[idx],
+                            _mm256_cvtepu8_epi32(lo));
+        _mm256_storeu_si256((__m256i *)&dest[idx + 8],
+                            _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)));
+        _mm256_storeu_si256((__m256i *)&dest[idx + 16],
+                            _mm256_cvtepu8_epi32(hi));
+        _mm256_storeu_si256((__m256i *)&dest[idx + 24],
+                            _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)));
+    }
+
+    return idx;
+}
+
+#endif
+
+
+/**
+ * Convert a UTF-8 string to UTF-32.
+ *
+ * Runs of ASCII characters are converted a block at a time, without
+ * decoding each character.
+ *
+ * @param[in,out] str
+ *   The string to convert. This is updated to remove the characters that
+ *   were converted.
+ *
+ * @param[out] dest
+ *   The array to write the codepoints to.
+ *
+ * @param[in] count
+ *   The size of the dest array.
+ *
+ * @return
+ *   The number of codepoints written. Conversion stops when the dest array
+ *   is full, or at an invalid or truncated sequence. If str is not empty
+ *   on return and fewer than count codepoints were written, str starts
+ *   with invalid UTF-8.
+ */
+static inline size_t
+mxstr_utf8_to_utf32(mxstr_t *str, uint32_t *dest, size_t count)
+{
+    mxstr_t run;
+    size_t  len;
+    size_t  n = 0;
+
+    while (!mxstr_empty(*str) && n < count) {
+        /* Convert runs of at least 8 ASCII characters in bulk. */
+        if (str->len >= 8 && count - n >= 8 &&
+            (mxutil_load_u64le(str->ptr) & 0x8080808080808080ULL) == 0) {
+            run = mxstr((char *)str->ptr, min(str->len, count - n));
+            len = 0;
+#ifdef MXUTIL_SIMD_X86
+            if (run.len >= 32 && mxutil_cpu_avx2()) {
+                len = mxstr_ascii_to_utf32_avx2(run, &dest[n]);
+                (void)mxstr_consume(&run, len);
+            }
+#endif
+            len += mxstr_ascii_to_utf32_scalar(run, &dest[n + len]);
+
+            (void)mxstr_consume(str, len);
+            n += len;
+            continue;
+        }
+
+        if (!mxstr_consume_utf8(str, &dest[n])) {
+            break;
+        }
+        n++;
+    }
+
+    return n;
+}
+
+
+/*
+ * ----------------------------------------------------------------------
+ * UTF-16
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * UTF-16 strings are arrays of code units in native byte order. Both
+ * conversion directions make a first pass to compute the size of the
+ * output (which also validates UTF-16 input), so that the output space
+ * can be allocated once.
+ */
+
+
+/**
+ * Compute the UTF-8 length of a UTF-16 string (scalar kernel).
+ *
+ * @param[in] src
+ *   The UTF-16 code units.
+ *
+ * @param[in] count
+ *   The number of code units.
+ *
+ * @param[in,out] len
+ *   The UTF-8 length of the code units is added to this.
+ *
+ * @return
+ *   Indicates whether the string is valid. false is returned if the string
+ *   contains an unpaired surrogate.
+ */
+static inline bool
+mxstr_utf16_utf8_len_scalar(const uint16_t *src, size_t count, size_t *len)
+{
+    size_t idx;
+    size_t n = 0;
+
+    for (idx = 0; idx < count; idx++) {
+        if (src[idx] < 0x80) {
+            n += 1;
+        } else if (src[idx] < 0x800) {
+            n += 2;
+        } else if ((src[idx] & 0xf800) != 0xd800) {
+            n += 3;
+        } else if (src[idx] < 0xdc00 && idx + 1 < count &&
+                   (src[idx + 1] & 0xfc00) == 0xdc00) {
+            n += 4;
+            idx++;
+        } else {
+            return false;
+        }
+    }
+
+    *len += n;
+
+    return true;
+}
+
+
+/**
+ * Convert a run of ASCII characters from UTF-16 to UTF-8 (scalar kernel).
+ *
+ * Code units are converted in blocks of 8, stopping at the first block
+ * containing a non-ASCII character.
+ *
+ * @return
+ *   The number of code units converted.
+ */
+static inline size_t
+mxstr_utf16_ascii_scalar(const uint16_t *src, size_t count,
+                         unsigned char *dest)
+{
+    size_t idx;
+    size_t pos;
+
+    for (idx = 0; idx + 8 <= count; idx += 8) {
+        if ((src[idx] | src[idx + 1] | src[idx + 2] | src[idx + 3] |
+             src[idx + 4] | src[idx + 5] | src[idx + 6] | src[idx + 7]) >=
+            0x80) {
+            break;
+        }
+
+        for (pos = idx; pos < idx + 8; pos++) {
+            dest[pos] = (unsigned char)src[pos];
+        }
+    }
+
+    return idx;
+}
+
+
+/**
+ * Convert a run of ASCII characters from UTF-8 to UTF-16 (scalar kernel).
+ *
+ * Characters are converted in blocks of 8, stopping at the first block
+ * containing a non-ASCII character.
+ *
+ * @return
+ *   The number of characters converted.
+ */
+static inline size_t
+mxstr_ascii_to_utf16_scalar(mxstr_t str, uint16_t *dest)
+{
+    size_t idx;
+    size_t pos;
+
+    for (idx = 0; idx + 8 <= str.len; idx += 8) {
+        if ((mxutil_load_u64le(&str.ptr[idx]) & 0x8080808080808080ULL) != 0) {
+            break;
+        }
+
+        for (pos = idx; pos < idx + 8; pos++) {
+            dest[pos] = str.ptr[pos];
+        }
+    }
+
+    return idx;
+}
+
+
+/**
+ * Compute the UTF-16 length of a UTF-8 string (scalar kernel).
+ *
+ * Every character other than a continuation byte starts a codepoint, and
+ * codepoints with a 4 byte encoding need a surrogate pair.
+ */
+static inline size_t
+mxstr_utf8_utf16_len_scalar(mxstr_t str)
+{
+    size_t idx;
+    size_t n = 0;
+
+    for (idx = 0; idx < str.len; idx++) {
+        n += ((str.ptr[idx] & 0xc0) != 0x80) + (str.ptr[idx] >= 0xf0);
+    }
+
+    return n;
+}
+
+
+#ifdef MXUTIL_SIMD_X86
+
+/**
+ * Compute the UTF-8 length of a UTF-16 string (AVX2 kernel).
+ *
+ * Surrogate pairs are checked by comparing the mask of high surrogates,
+ * shifted by one code unit, with the mask of low surrogates.
+ *
+ * @return
+ *   See mxstr_utf16_utf8_len_scalar().
+ */
+MXUTIL_TARGET("avx2,popcnt") static inline bool
+mxstr_utf16_utf8_len_avx2(const uint16_t *src, size_t count, size_t *len)
+{
+    __m256i       in, surrogate;
+    uint32_t      ge80, ge800, surr, high, low;
+    uint32_t      carry = 0;
+    size_t        idx;
+    size_t        n = 0;
+
+    for (idx = 0; idx + 16 <= count; idx += 16) {
+        in = _mm256_loadu_si256((__m256i *)&src[idx]);
+
+        /* Each mask has 2 bits per code unit. */
+        ge80 = ~_mm256_movemask_epi8(_mm256_cmpeq_epi16(
+            _mm256_and_si256(in, _mm256_set1_epi16((short)0xff80)),
+            _mm256_setzero_si256()));
+        ge800 = ~_mm256_movemask_epi8(_mm256_cmpeq_epi16(
+            _mm256_and_si256(in, _mm256_set1_epi16((short)0xf800)),
+            _mm256_setzero_si256()));
+
+        surrogate = _mm256_and_si256(in, _mm256_set1_epi16((short)0xfc00));
+        high = _mm256_movemask_epi8(_mm256_cmpeq_epi16(
+            surrogate, _mm256_set1_epi16((short)0xd800)));
+        low = _mm256_movemask_epi8(_mm256_cmpeq_epi16(
+            surrogate, _mm256_set1_epi16((short)0xdc00)));
+        surr = high | low;
+
+        if (low != ((high << 2) | carry)) {
+            return false;
+        }
+        carry = high >> 30;
+
+        n += 16 + (__builtin_popcount(ge80) +
+                   __builtin_popcount(ge800 & ~surr)) / 2;
+    }
+
+    /* A trailing high surrogate is paired up by the scalar kernel. */
+    if (carry != 0) {
+        idx--;
+        n -= 2;
+    }
+
+    *len += n;
+
+    return mxstr_utf16_utf8_len_scalar(&src[idx], count - idx, len);
+}
+
+
+/**
+ * Convert a run of ASCII characters from UTF-16 to UTF-8 (AVX2 kernel).
+ *
+ * Code units are converted in blocks of 32.
+ *
+ * @return
+ *   See mxstr_utf16_ascii_scalar().
+ */
+MXUTIL_TARGET("avx2") static inline size_t
+mxstr_utf16_ascii_avx2(const uint16_t *src, size_t count, unsigned char *dest)
+{
+    const __m256i mask = _mm256_set1_epi16((short)0xff80);
+    __m256i       lo;
+    __m256i       hi;
+    size_t        idx;
+
+    for (idx = 0; idx + 32 <= count; idx += 32) {
+        lo = _mm256_loadu_si256((__m256i *)&src[idx]);
+        hi = _mm256_loadu_si256((__m256i *)&src[idx + 16]);
+
+        if (!_mm256_testz_si256(_mm256_or_si256(lo, hi), mask)) {
+            break;
+        }
+
+        /* The pack interleaves the 128 bit lanes, so reorder them. */
+        _mm256_storeu_si256((__m256i *)&dest[idx], _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(lo, hi), 0xd8));
+    }
+
+    return idx;
+}
+
+
+/**
+ * Convert a run of ASCII characters from UTF-8 to UTF-16 (AVX2 kernel).
+ *
+ * Characters are converted in blocks of 32.
+ *
+ * @return
+ *   See mxstr_ascii_to_utf16_scalar().
+ */
+MXUTIL_TARGET("avx2") static inline size_t
+mxstr_ascii_to_utf16_avx2(mxstr_t str, uint16_t *dest)
+{
+    __m256i in;
+    size_t  idx;
+
+    for (idx = 0; idx + 32 <= str.len; idx += 32) {
+        in = _mm256_loadu_si256((__m256i *)&str.ptr[idx]);
+        if (_mm256_movemask_epi8(in) != 0) {
+            break;
+        }
+
+        _mm256_storeu_si256((__m256i *)&dest[idx],
+                            _mm256_cvtepu8_epi16(_mm256_castsi256_si128(in)));
+        _mm256_storeu_si256((__m256i *)&dest[idx + 16],
+                            _mm256_cvtepu8_epi16(
+                                _mm256_extracti128_si256(in, 1)));
+    }
+
+    return idx;
+}
+
+
+/**
+ * Compute the UTF-16 length of a UTF-8 string (AVX2 kernel).
+ */
+MXUTIL_TARGET("avx2,popcnt") static inline size_t
+mxstr_utf8_utf16_len_avx2(mxstr_t str)
+{
+    __m256i in;
+    size_t  idx;
+    size_t  n = 0;
+
+    for (idx = 0; idx + 32 <= str.len; idx += 32) {
+        in = _mm256_loadu_si256((__m256i *)&str.ptr[idx]);
+
+        /* As signed bytes, continuation bytes are -128..-65 and 4 byte
+         * leads are -16..-1. */
+        n += __builtin_popcount((uint32_t)_mm256_movemask_epi8(
+                _mm256_cmpgt_epi8(in, _mm256_set1_epi8(-65)))) +
+            __builtin_popcount((uint32_t)_mm256_movemask_epi8(
+                _mm256_cmpgt_epi8(in, _mm256_set1_epi8(-17))) &
+                (uint32_t)_mm256_movemask_epi8(in));
+    }
+
+    (void)mxstr_consume(&str, idx);
+
+    return n + mxstr_utf8_utf16_len_scalar(str);
+}
+
+#endif
+
+
+/**
+ * Compute the UTF-8 length of a UTF-16 string.
+ *
+ * @param[in] src
+ *   The UTF-16 code units.
+ *
+ * @param[in] count
+ *   The number of code units.
+ *
+ * @param[out] len
+ *   The length of the string when converted to UTF-8.
+ *
+ * @return
+ *   Indicates whether the string is valid UTF-16. false is returned if the
+ *   string contains an unpaired surrogate.
+ */
+static inline bool
+mxstr_utf16_utf8_len(const uint16_t *src, size_t count, size_t *len)
+{
+    *len = 0;
+
+#ifdef MXUTIL_SIMD_X86
+    if (count >= 16 && mxutil_cpu_avx2() && mxutil_cpu_popcnt()) {
+        return mxstr_utf16_utf8_len_avx2(src, count, len);
+    }
+#endif
+
+    return mxstr_utf16_utf8_len_scalar(src, count, len);
+}
+
+
+/**
+ * Write a UTF-16 string to a buffer as UTF-8.
+ *
+ * The output length is computed first, so that the buffer is resized at
+ * most once. Runs of ASCII characters are converted a block at a time.
+ *
+ * @param[in] buffer
+ *   The buffer to write to.
+ *
+ * @param[in] src
+ *   The UTF-16 code units, in native byte order.
+ *
+ * @param[in] count
+ *   The number of code units.
+ *
+ * @return
+ *   Indicates whether the string was written. false is returned if the
+ *   string contains an unpaired surrogate, in which case nothing is
+ *   written.
+ */
+static inline bool
+mxbuf_write_utf16(mxbuf_t *buffer, const uint16_t *src, size_t count)
+{
+    mxstr_t  out;
+    uint32_t c;
+    size_t   len;
+    size_t   idx = 0;
+
+    if (!mxstr_utf16_utf8_len(src, count, &len)) {
+        return false;
+    }
+
+    mxbuf_require(buffer, len);
+    out = buffer->available;
+
+    while (idx < count) {
+        if (count - idx >= 8 && src[idx] < 0x80) {
+            len = 0;
+#ifdef MXUTIL_SIMD_X86
+            if (count - idx >= 32 && mxutil_cpu_avx2()) {
+                len = mxstr_utf16_ascii_avx2(&src[idx], count - idx, out.ptr);
+            }
+#endif
+            len += mxstr_utf16_ascii_scalar(&src[idx + len], count - idx - len,
+                                            &out.ptr[len]);
+            if (len > 0) {
+                (void)mxstr_consume(&out, len);
+                idx += len;
+                continue;
+            }
+        }
+
+        c = src[idx++];
+        if ((c & 0xfc00) == 0xd800) {
+            c = 0x10000 + ((c - 0xd800) << 10) + (src[idx++] - 0xdc00);
+        }
+
+        (void)mxstr_put_utf8(&out, c);
+    }
+
+    mxbuf_commit(buffer, mxstr_substr_offset(buffer->available, out));
+
+    return true;
+}
+
+
+/**
+ * Compute the UTF-16 length of a UTF-8 string.
+ *
+ * @param[in] str
+ *   The string. This must be valid UTF-8 (see mxstr_utf8_validate()).
+ *
+ * @return
+ *   The number of UTF-16 code units needed to represent the string.
+ */
+static inline size_t
+mxstr_utf8_utf16_len(mxstr_t str)
+{
+#ifdef MXUTIL_SIMD_X86
+    if (str.len >= 32 && mxutil_cpu_avx2() && mxutil_cpu_popcnt()) {
+        return mxstr_utf8_utf16_len_avx2(str);
+    }
+#endif
+
+    return mxstr_utf8_utf16_len_scalar(str);
+}
+
+
+/**
+ * Convert a UTF-8 string to UTF-16.
+ *
+ * Runs of ASCII characters are converted a block at a time, without
+ * decoding each character. Codepoints above U+FFFF are written as
+ * surrogate pairs. The required size of the dest array can be computed
+ * using mxstr_utf8_utf16_len().
+ *
+ * @param[in,out] str
+ *   The string to convert. This is updated to remove the characters that
+ *   were converted.
+ *
+ * @param[out] dest
+ *   The array to write the code units to, in native byte order.
+ *
+ * @param[in] count
+ *   The size of the dest array.
+ *
+ * @return
+ *   The number of code units written. Conversion stops when the dest array
+ *   is full (a surrogate pair is not split), or at an invalid or truncated
+ *   sequence.
+ */
+static inline size_t
+mxstr_utf8_to_utf16(mxstr_t *str, uint16_t *dest, size_t count)
+{
+    mxstr_t  run;
+    uint32_t c;
+    size_t   len;
+    size_t   n = 0;
+
+    while (!mxstr_empty(*str) && n < count) {
+        /* Convert runs of at least 8 ASCII characters in bulk. */
+        if (str->len >= 8 && count - n >= 8 &&
+            (mxutil_load_u64le(str->ptr) & 0x8080808080808080ULL) == 0) {
+            run = mxstr((char *)str->ptr, min(str->len, count - n));
+            len = 0;
+#ifdef MXUTIL_SIMD_X86
+            if (run.len >= 32 && mxutil_cpu_avx2()) {
+                len = mxstr_ascii_to_utf16_avx2(run, &dest[n]);
+                (void)mxstr_consume(&run, len);
+            }
+#endif
+            len += mxstr_ascii_to_utf16_scalar(run, &dest[n + len]);
+
+            (void)mxstr_consume(str, len);
+            n += len;
+            continue;
+        }
+
+        len = mxstr_utf8_decode(str->ptr, str->len, &c);
+        if (len == 0 || (c >= 0x10000 && count - n < 2)) {
+            break;
+        }
+
+        if (c >= 0x10000) {
+            dest[n++] = 0xd800 + ((c - 0x10000) >> 10);
+            dest[n++] = 0xdc00 + (c & 0x3ff);
+        } else {
+            dest[n++] = c;
+        }
+
+        (void)mxstr_consume(str, len);
+    }
+
+    return n;
+}
+
+
+#endif
@@ -10,7 +10,14 @@
 #define MXUTIL_H
 
 #include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 
 /**
@@ -66,21 +73,460 @@
 #define max(arg1_, arg2_)  ((arg1_) > (arg2_) ? (arg1_) : (arg2_))
 
 
+/*
+ * ----------------------------------------------------------------------
+ * SIMD support
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Vectorised implementations are provided for x86-64 when building with
+ * gcc or clang. SSE2 is part of the x86-64 baseline and is used
+ * unconditionally. Wider kernels (AVX2, AVX-512) are compiled using
+ * function target attributes and selected at runtime based on the CPU
+ * features, so no special compiler flags are needed.
+ *
+ * Define MXUTIL_NO_SIMD before including any of the headers to force the
+ * portable scalar implementations.
+ */
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(MXUTIL_NO_SIMD)
+#define MXUTIL_SIMD_X86 1
+#include <immintrin.h>
+
+/**
+ * Compile a function for a specific instruction set extension.
+ *
+ * @param[in] target_
+ *   The target string, e.g. "avx2".
+ */
+#define MXUTIL_TARGET(target_) __attribute__((target(target_)))
+#endif
+
+
+/**
+ * Test whether the CPU supports the SSSE3 instruction set.
+ */
+static inline bool
+mxutil_cpu_ssse3(void)
+{
+#ifdef MXUTIL_SIMD_X86
+    return __builtin_cpu_supports("ssse3");
+#else
+    return false;
+#endif
+}
+
+
+/**
+ * Test whether the CPU supports the AVX2 instruction set.
+ */
+static inline bool
+mxutil_cpu_avx2(void)
+{
+#ifdef MXUTIL_SIMD_X86
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+
+/**
+ * Test whether the CPU supports the carry-less multiplication instruction.
+ */
+static inline bool
+mxutil_cpu_pclmul(void)
+{
+#ifdef MXUTIL_SIMD_X86
+    return __builtin_cpu_supports("pclmul");
+#else
+    return false;
+#endif
+}
+
+
+/**
+ * Test whether the CPU supports the population count instruction.
+ */
+static inline bool
+mxutil_cpu_popcnt(void)
+{
+#ifdef MXUTIL_SIMD_X86
+    return __builtin_cpu_supports("popcnt");
+#else
+    return false;
+#endif
+}
+
+
+/**
+ * Test whether the CPU supports the first bit manipulation instruction set.
+ */
+static inline bool
+mxutil_cpu_bmi(void)
+{
+#ifdef MXUTIL_SIMD_X86
+    return __builtin_cpu_supports("bmi");
+#else
+    return false;
+#endif
+}
+
+
+/**
+ * Test whether the CPU supports the AVX-512 foundation and byte/word
+ * instruction sets.
+ */
+static inline bool
+mxutil_cpu_avx512bw(void)
+{
+#ifdef MXUTIL_SIMD_X86
+    return (__builtin_cpu_supports("avx512f") &&
+            __builtin_cpu_supports("avx512bw"));
+#else
+    return false;
+#endif
+}
+
+
+/**
+ * Load an unaligned 64 bit little endian value.
+ *
+ * @param[in] ptr
+ *   Pointer to the first of 8 bytes to load.
+ *
+ * @return
+ *   The loaded value. The byte at ptr is the least significant byte.
+ */
+static inline uint64_t
+mxutil_load_u64le(const void *ptr)
+{
+    uint64_t value;
+
+    memcpy(&value, ptr, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+
+    return value;
+}
+
+
+/**
+ * Load an unaligned 32 bit little endian value.
+ *
+ * @param[in] ptr
+ *   Pointer to the first of 4 bytes to load.
+ *
+ * @return
+ *   The loaded value. The byte at ptr is the least significant byte.
+ */
+static inline uint32_t
+mxutil_load_u32le(const void *ptr)
+{
+    uint32_t value;
+
+    memcpy(&value, ptr, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+
+    return value;
+}
+
+
+/**
+ * Set the high bit of each byte of a word that is zero.
+ *
+ * This is exact: bytes that are non-zero never have their high bit set in
+ * the result, so the lowest and highest set bits can be used to locate
+ * the first and last zero bytes.
+ *
+ * @param[in] word
+ *   The word to test.
+ *
+ * @return
+ *   A mask with 0x80 in each byte position where word has a zero byte.
+ */
+static inline uint64_t
+mxutil_swar_zero(uint64_t word)
+{
+    const uint64_t low7 = 0x7f7f7f7f7f7f7f7fULL;
+
+    return ~(((word & low7) + low7) | word | low7);
+}
+
+
 /**
  * Find the smallest power of 2 that is larger than the input parameter.
  *
  * This function is typically used when growing array or buffer sizes.
  *
  * @param[in] value
- *   Find the smallest power of 2 larger than this value.
+ *   Find the smallest power of 2 larger than this value. The result must
+ *   be representable in a size_t.
  *
  * @return
- *   The first power of 2 larger than value.
+ *   The first power of 2 larger than value (1 if value is 0).
  */
-static inline uint32_t
-mxutil_size_p2(uint32_t value)
+static inline size_t
+mxutil_size_p2(size_t value)
 {
-    return 1 << (32 - __builtin_clz(value));
+    assert(value < (SIZE_MAX >> 1) + 1);
+
+    if (value == 0) {
+        return 1;
+    }
+
+    return (size_t)1 << (64 - __builtin_clzll(value));
+}
+
+
+/*
+ * ----------------------------------------------------------------------
+ * Memory allocation
+ * ----------------------------------------------------------------------
+ */
+
+/**
+ * A memory allocator.
+ *
+ * Allocators allow memory to be obtained from somewhere other than the
+ * libc heap, e.g. jemalloc/mimalloc arenas, hugepage pools or per-thread
+ * caches. An allocator may be installed globally using
+ * mxutil_allocator_set(), or used for an individual buffer (see
+ * mxbuf_allocator()).
+ *
+ * Each function is passed the context pointer supplied along with the
+ * allocator. Allocation functions must not return NULL.
+ */
+typedef struct {
+    /** Allocate size bytes of memory. */
+    void   *(*alloc)(void *ctx, size_t size);
+
+    /** Resize memory (ptr may be NULL). old_size is any size between the
+     *  size previously requested for ptr and its usable size (buffers pass
+     *  the usable size), or 0 when unknown (e.g. from mxutil_realloc()). */
+    void   *(*resize)(void *ctx, void *ptr, size_t old_size, size_t size);
+
+    /** Release memory (ptr may be NULL). size is any size between the size
+     *  previously requested for ptr and its usable size, or 0 when
+     *  unknown. */
+    void    (*release)(void *ctx, void *ptr, size_t size);
+
+    /** Get the usable size of an allocation of size bytes at ptr. The
+     *  usable size is at least size. May be NULL if there is no slack. */
+    size_t  (*usable_size)(void *ctx, void *ptr, size_t size);
+} mxutil_allocator_t;
+
+
+/**
+ * The global allocator, or NULL to use libc.
+ *
+ * These are weak definitions so that every translation unit shares the
+ * same global allocator.
+ */
+__attribute__((weak)) const mxutil_allocator_t *mxutil_allocator_global;
+__attribute__((weak)) void *mxutil_allocator_global_ctx;
+
+
+/**
+ * Install a global allocator.
+ *
+ * The global allocator is used by mxutil_malloc(), mxutil_calloc(),
+ * mxutil_realloc() and mxutil_free(), and by any buffer that does not
+ * have its own allocator. It must be set before any memory is allocated,
+ * and is not thread safe with respect to concurrent allocations.
+ *
+ * @param[in] allocator
+ *   The allocator, or NULL to restore the libc allocator.
+ *
+ * @param[in] ctx
+ *   Context passed to the allocator functions.
+ */
+static inline void
+mxutil_allocator_set(const mxutil_allocator_t *allocator, void *ctx)
+{
+    mxutil_allocator_global = allocator;
+    mxutil_allocator_global_ctx = ctx;
+}
+
+
+/**
+ * Handle an allocation failure.
+ */
+static inline void
+mxutil_check_alloc(void *ptr)
+{
+    if (ptr == NULL) {
+        abort();
+    }
+}
+
+
+/**
+ * Allocate memory using an allocator.
+ *
+ * @param[in] allocator
+ *   The allocator, or NULL for the global allocator.
+ *
+ * @param[in] ctx
+ *   The allocator context.
+ *
+ * @param[in] size
+ *   The size of memory to allocate.
+ *
+ * @return
+ *   Pointer to the allocated memory. NULL is never returned.
+ */
+static inline void *
+mxutil_allocator_alloc(const mxutil_allocator_t *allocator, void *ctx,
+                       size_t size)
+{
+    void *ptr;
+
+    if (allocator == NULL) {
+        allocator = mxutil_allocator_global;
+        ctx = mxutil_allocator_global_ctx;
+    }
+
+    if (allocator != NULL) {
+        ptr = allocator->alloc(ctx, size);
+    } else {
+        ptr = malloc(size);
+    }
+
+    mxutil_check_alloc(ptr);
+
+    return ptr;
+}
+
+
+/**
+ * Resize memory using an allocator.
+ *
+ * @param[in] allocator
+ *   The allocator, or NULL for the global allocator.
+ *
+ * @param[in] ctx
+ *   The allocator context.
+ *
+ * @param[in] ptr
+ *   The memory to resize. NULL may be passed.
+ *
+ * @param[in] old_size
+ *   Any size between the size previously requested for ptr and its usable
+ *   size, or 0 if unknown.
+ *
+ * @param[in] size
+ *   The new size. 0 must not be passed: realloc() may then free the memory
+ *   and return NULL, which is treated as an allocation failure and aborts
+ *   the process. Use mxutil_allocator_release() instead.
+ *
+ * @return
+ *   Pointer to the resized memory. NULL is never returned.
+ */
+static inline void *
+mxutil_allocator_resize(const mxutil_allocator_t *allocator, void *ctx,
+                        void *ptr, size_t old_size, size_t size)
+{
+    assert(size > 0);
+
+    if (allocator == NULL) {
+        allocator = mxutil_allocator_global;
+        ctx = mxutil_allocator_global_ctx;
+    }
+
+    if (allocator != NULL) {
+        ptr = allocator->resize(ctx, ptr, old_size, size);
+    } else {
+        ptr = realloc(ptr, size);
+    }
+
+    mxutil_check_alloc(ptr);
+
+    return ptr;
+}
+
+
+/**
+ * Release memory using an allocator.
+ *
+ * @param[in] allocator
+ *   The allocator, or NULL for the global allocator.
+ *
+ * @param[in] ctx
+ *   The allocator context.
+ *
+ * @param[in] ptr
+ *   The memory to release. NULL may be passed.
+ *
+ * @param[in] size
+ *   Any size between the size previously requested for ptr and its usable
+ *   size, or 0 if unknown.
+ */
+static inline void
+mxutil_allocator_release(const mxutil_allocator_t *allocator, void *ctx,
+                         void *ptr, size_t size)
+{
+    if (allocator == NULL) {
+        allocator = mxutil_allocator_global;
+        ctx = mxutil_allocator_global_ctx;
+    }
+
+    if (allocator != NULL) {
+        allocator->release(ctx, ptr, size);
+    } else {
+        free(ptr);
+    }
+}
+
+
+/**
+ * Get the usable size of memory returned by an allocator.
+ *
+ * Allocators typically round requests up to a size class. The slack may be
+ * used by the caller (e.g. as extra buffer capacity) rather than wasted.
+ *
+ * @param[in] allocator
+ *   The allocator, or NULL for the global allocator.
+ *
+ * @param[in] ctx
+ *   The allocator context.
+ *
+ * @param[in] ptr
+ *   The memory.
+ *
+ * @param[in] size
+ *   The size requested for ptr.
+ *
+ * @return
+ *   The usable size of the memory. This is at least size.
+ */
+static inline size_t
+mxutil_allocator_usable_size(const mxutil_allocator_t *allocator, void *ctx,
+                             void *ptr, size_t size)
+{
+    size_t usable = size;
+
+    if (allocator == NULL) {
+        allocator = mxutil_allocator_global;
+        ctx = mxutil_allocator_global_ctx;
+    }
+
+    if (allocator != NULL) {
+        if (allocator->usable_size != NULL) {
+            usable = allocator->usable_size(ctx, ptr, size);
+        }
+    } else {
+#ifdef __GLIBC__
+        usable = malloc_usable_size(ptr);
+#endif
+    }
+
+    assert(usable >= size);
+
+    return usable;
 }
 
 
@@ -98,12 +544,7 @@ mxutil_size_p2(uint32_t value)
 static inline void *
 mxutil_malloc(size_t size)
 {
-    void *ptr;
-
-    ptr = malloc(size);
-    assert(ptr != NULL);
-
-    return ptr;
+    return mxutil_allocator_alloc(NULL, NULL, size);
 }
 
 
@@ -123,8 +564,13 @@ mxutil_calloc(size_t size)
 {
     void *ptr;
 
-    ptr = calloc(1, size);
-    assert(ptr != NULL);
+    if (mxutil_allocator_global == NULL) {
+        ptr = calloc(1, size);
+        mxutil_check_alloc(ptr);
+    } else {
+        ptr = mxutil_malloc(size);
+        memset(ptr, 0, size);
+    }
 
     return ptr;
 }
@@ -148,12 +594,21 @@ mxutil_calloc(size_t size)
 static inline void *
 mxutil_realloc(void *data, size_t size)
 {
-    void *ptr;
+    return mxutil_allocator_resize(NULL, NULL, data, 0, size);
+}
 
-    ptr = realloc(data, size);
-    assert(ptr != NULL);
 
-    return ptr;
+/**
+ * Free a block of memory.
+ *
+ * @param[in] ptr
+ *   Pointer to a block of memory allocated by mxutil_malloc(),
+ *   mxutil_calloc() or mxutil_realloc(). NULL may be passed.
+ */
+static inline void
+mxutil_free(void *ptr)
+{
+    mxutil_allocator_release(NULL, NULL, ptr, 0);
 }
 
 